@@ -1,3 +1,6 @@
+    # expect: x5 = 12
+    # expect: x6 = 8
+    # expect: x7 = 20
     .section .text
     .globl _start
 _start:
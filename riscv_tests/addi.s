@@ -1,3 +1,5 @@
+    # expect: x1 = 10
+    # expect: x2 = 15
     .section .text
     .globl _start
 _start:
@@ -1,3 +1,4 @@
+    # expect: x3 = 8
     .section .text
     .globl _start
 _start:
@@ -1,3 +1,4 @@
+    # expect: x1 = 0x11000
     .section .text
     .globl _start
 _start:
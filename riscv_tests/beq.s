@@ -1,3 +1,5 @@
+    # expect: x3 = 2
+    # expect: insns = 5
     .section .text
     .globl _start
 _start:
@@ -1,3 +1,5 @@
+    # expect: x3 = 9
+    # expect: insns = 5
     .section .text
     .globl _start
 _start:
@@ -0,0 +1,25 @@
+    # expect: x10 = 55
+    # expect: x2 = 0x20000
+    # expect: x1 = 0x1000c
+    # expect: insns = 121
+    .section .text
+    .globl _start
+_start:
+    lui  sp, 0x20
+    addi a0, x0, 10
+    jal  ra, sum
+    ecall
+    # sum(n) = n + sum(n - 1), sum(0) = 0, with a stack frame per call
+sum:
+    addi sp, sp, -16
+    sw   ra, 12(sp)
+    sw   a0, 8(sp)
+    beq  a0, x0, done
+    addi a0, a0, -1
+    jal  ra, sum
+    lw   t0, 8(sp)
+    add  a0, a0, t0
+done:
+    lw   ra, 12(sp)
+    addi sp, sp, 16
+    ret
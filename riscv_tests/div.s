@@ -1,3 +1,4 @@
+    # expect: x7 = 3
     .section .text
     .globl _start
 _start:
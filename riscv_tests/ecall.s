@@ -1,3 +1,4 @@
+    # expect: insns = 1
     .section .text
     .globl _start
 _start:
@@ -1,3 +1,6 @@
+    # expect: x1 = 0x10004
+    # expect: x2 = 7
+    # expect: insns = 3
     .section .text
     .globl _start
 _start:
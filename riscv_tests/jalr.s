@@ -1,3 +1,7 @@
+    # expect: x1 = 0x10010
+    # expect: x2 = 0x10014
+    # expect: x3 = 5
+    # expect: insns = 6
     .section .text
     .globl _start
 _start:
@@ -0,0 +1,20 @@
+    # expect: x10 = 20100
+    # expect: x11 = 50
+    # expect: x5 = 0
+    # expect: insns = 1054
+    .section .text
+    .globl _start
+_start:
+    addi t0, x0, 200
+    addi a0, x0, 0
+    addi a1, x0, 0
+    # sum 200..1, counting the multiples of 4 on a rarely taken path
+loop:
+    add  a0, a0, t0
+    andi t1, t0, 3
+    bne  t1, x0, skip
+    addi a1, a1, 1
+skip:
+    addi t0, t0, -1
+    bne  t0, x0, loop
+    ecall
@@ -1,3 +1,4 @@
+    # expect: x1 = 0x12345000
     .section .text
     .globl _start
 _start:
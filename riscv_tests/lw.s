@@ -1,3 +1,4 @@
+    # expect: x2 = 1234
     .section .text
     .globl _start
 _start:
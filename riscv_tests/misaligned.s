@@ -0,0 +1,23 @@
+    # expect: x11 = 0x12345678
+    # expect: x12 = 0x3456
+    # expect: x13 = 0xffffbeef
+    # expect: x14 = 0x34
+    # expect: insns = 13
+    # misaligned accesses are emulated by the test runner, including a word
+    # that crosses the page boundary at 0x30000
+    .section .text
+    .globl _start
+_start:
+    lui  a0, 0x30
+    addi a0, a0, -2
+    lui  a1, 0x12345
+    addi a1, a1, 0x678
+    sw   a1, 0(a0)
+    lw   a1, 0(a0)
+    lhu  a2, 1(a0)
+    lui  t0, 0xc
+    addi t0, t0, -0x111
+    sh   t0, 3(a0)
+    lh   a3, 3(a0)
+    lb   a4, 2(a0)
+    ecall
@@ -1,3 +1,4 @@
+    # expect: x7 = 21
     .section .text
     .globl _start
 _start:
@@ -1,3 +1,4 @@
+    # expect: x7 = 0xffffffff
     .section .text
     .globl _start
 _start:
@@ -1,3 +1,4 @@
+    # expect: x7 = 0
     .section .text
     .globl _start
 _start:
@@ -1,3 +1,4 @@
+    # expect: x3 = 11
     .section .text
     .globl _start
 _start:
@@ -1,3 +1,4 @@
+    # expect: x7 = 1
     .section .text
     .globl _start
 _start:
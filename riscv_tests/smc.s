@@ -0,0 +1,22 @@
+    # expect: x10 = 101
+    # expect: insns = 18
+    # Self-modifying code: after the first call, the addi in inc is
+    # overwritten with "addi a0, a0, 100", and the second call must run it
+    .section .text
+    .globl _start
+_start:
+    addi  s0, x0, 2
+    lui   t0, 0x6450
+    addi  t0, t0, 0x513
+here:
+    auipc t1, 0
+    addi  t1, t1, 28     # inc
+loop:
+    jal   ra, inc
+    sw    t0, 0(t1)
+    addi  s0, s0, -1
+    bne   s0, x0, loop
+    ecall
+inc:
+    addi  a0, a0, 1
+    ret
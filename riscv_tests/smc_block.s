@@ -0,0 +1,21 @@
+    # expect: x10 = 100
+    # expect: x11 = 200
+    # expect: insns = 12
+    # Self-modifying code in the running block: each sw overwrites the
+    # instruction right after it, which must then run with its new code.
+    # The second sw is fused with the next sw (superinstruction SW+SW).
+    .section .text
+    .globl _start
+_start:
+    lui   t0, 0x6400
+    addi  t0, t0, 0x513     # addi a0, x0, 100
+    auipc t1, 0
+    sw    t0, 8(t1)
+    addi  a0, x0, 1
+    lui   t0, 0xc800
+    addi  t0, t0, 0x593     # addi a1, x0, 200
+    addi  t2, sp, -16
+    auipc t1, 0
+    sw    t0, 8(t1)
+    sw    t0, 0(t2)
+    ecall
@@ -1,3 +1,4 @@
+    # expect: x3 = 4
     .section .text
     .globl _start
 _start:
@@ -1,3 +1,5 @@
+    # expect: x2 = 99
+    # expect: x3 = 99
     .section .text
     .globl _start
 _start:
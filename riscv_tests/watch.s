@@ -0,0 +1,25 @@
+    # expect: x10 = 2
+    # expect: insns = 13
+    # watch: 0x20008
+    # watch: 0x2000c
+    # watch: 0x1fffc
+    # watch: 0x1fff8
+    # Watchpoints stop the run right after the store that hits them on
+    # every engine: in the middle of a block, in either half of a fused
+    # SW+SW and at stores relative to sp
+    .section .text
+    .globl _start
+_start:
+    lui   sp, 0x20
+    lui   t2, 0x20
+    addi  t0, x0, 5
+    sw    t0, 0(t2)
+    sw    t0, 4(t2)
+    sw    t0, 8(t2)
+    sw    t0, 12(t2)
+    addi  ra, x0, 7
+    sw    ra, -4(sp)
+    sw    t0, -8(sp)
+    addi  a0, x0, 1
+    addi  a0, a0, 1
+    ecall
@@ -1,3 +1,4 @@
+    # expect: x3 = 6
     .section .text
     .globl _start
 _start:
@@ -0,0 +1,438 @@
+// Benchmark harness for the simulator.
+//
+// Runs every program in ../predictor-benchmarks a number of times with fixed
+// inputs, collects MIPS, wall time, peak RSS and the predictor results printed
+// by the simulator, and compares them against a stored baseline file.
+// Exits with status 1 if throughput regressed beyond the threshold or if the
+// simulated results (instruction count, mispredictions) changed at all.
+//
+// With -H every benchmark is additionally run with --host-perf, with and
+// without --huge-pages, to report the host dTLB misses and page faults of
+// the execute phase with both kinds of guest memory backing.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define MAX_REPS 64
+#define NUM_LEVELS 4
+
+struct benchmark
+{
+  const char *name;
+  const char *elf;
+  const char *args[4]; // arguments after '--', NULL terminated
+};
+
+// radix.elf is not listed: it needs the file ecalls (open/read/write) which the
+// simulator does not implement yet.
+static const struct benchmark benchmarks[] = {
+  {"fib", "fib.elf", {"30", NULL}},
+  {"erat", "erat.elf", {NULL}},
+};
+#define NUM_BENCHMARKS (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+struct result
+{
+  long insns;
+  double mips;
+  double wall;     // seconds
+  long max_rss_kb; // peak resident set size of the simulator process
+  long nt_miss;
+  long btfnt_miss;
+  long bimodal_miss[NUM_LEVELS];
+  long gshare_miss[NUM_LEVELS];
+  long dtlb_misses; // execute phase, -1 if not available
+  long page_faults;
+};
+
+struct baseline
+{
+  char name[32];
+  struct result res;
+};
+
+static const int level_sizes[NUM_LEVELS] = {256, 1024, 4096, 16384};
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Read everything from fd into a malloc'ed, zero terminated buffer
+static char *slurp(int fd)
+{
+  size_t size = 0, cap = 1 << 16;
+  char *buf = malloc(cap);
+  ssize_t n;
+  while (buf && (n = read(fd, buf + size, cap - size - 1)) > 0)
+  {
+    size += n;
+    if (cap - size - 1 == 0)
+    {
+      cap *= 2;
+      buf = realloc(buf, cap);
+    }
+  }
+  if (buf)
+    buf[size] = 0;
+  return buf;
+}
+
+// Find "<prefix>%ld predictions, %ld mispredictions" in the simulator output
+static long parse_miss(const char *out, const char *prefix)
+{
+  const char *p = strstr(out, prefix);
+  long pred, miss;
+  if (p && sscanf(p + strlen(prefix), " %ld predictions, %ld mispredictions", &pred, &miss) == 2)
+    return miss;
+  return 0;
+}
+
+// Execute column of a counter line in the --host-perf table, -1 if n/a
+static long parse_counter(const char *out, const char *name)
+{
+  char prefix[64];
+  snprintf(prefix, sizeof(prefix), "\n%s ", name);
+  const char *p = strstr(out, prefix);
+  long load, execute;
+  if (p && sscanf(p + strlen(prefix), " %ld %ld", &load, &execute) == 2)
+    return execute;
+  return -1;
+}
+
+static int parse_output(const char *out, struct result *res)
+{
+  const char *p = strstr(out, "\nSimulated ");
+  int ticks;
+  if (!p || sscanf(p, "\nSimulated %ld instructions in %d host ticks (%lf MIPS)",
+                   &res->insns, &ticks, &res->mips) != 3)
+    return -1;
+  res->nt_miss = parse_miss(p, "\nNT predictor:");
+  res->btfnt_miss = parse_miss(p, "\nBTFNT predictor:");
+  for (int i = 0; i < NUM_LEVELS; i++)
+  {
+    char prefix[32];
+    snprintf(prefix, sizeof(prefix), "\nBimodal %d:", level_sizes[i]);
+    res->bimodal_miss[i] = parse_miss(p, prefix);
+    snprintf(prefix, sizeof(prefix), "\ngShare %d:", level_sizes[i]);
+    res->gshare_miss[i] = parse_miss(p, prefix);
+  }
+  res->dtlb_misses = parse_counter(p, "dTLB-misses");
+  res->page_faults = parse_counter(p, "page-faults");
+  return 0;
+}
+
+// Run the simulator once on a benchmark, stdout is captured and parsed.
+// options is a NULL terminated list of extra simulator options.
+static int run_once(const char *sim, const char *dir, const struct benchmark *b,
+                    const char *const *options, struct result *res)
+{
+  char elf_path[1024];
+  snprintf(elf_path, sizeof(elf_path), "%s/%s", dir, b->elf);
+  const char *argv[16];
+  int argc = 0;
+  argv[argc++] = sim;
+  argv[argc++] = elf_path;
+  for (int i = 0; options && options[i]; i++)
+    argv[argc++] = options[i];
+  if (b->args[0])
+  {
+    argv[argc++] = "--";
+    for (int i = 0; b->args[i]; i++)
+      argv[argc++] = b->args[i];
+  }
+  argv[argc] = NULL;
+
+  int fds[2];
+  if (pipe(fds))
+  {
+    perror("pipe");
+    return -1;
+  }
+  double start = now();
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0)
+  {
+    int null_fd = open("/dev/null", O_RDWR);
+    dup2(null_fd, 0);
+    dup2(null_fd, 2);
+    dup2(fds[1], 1);
+    close(fds[0]);
+    execv(sim, (char *const *)argv);
+    _exit(127);
+  }
+  close(fds[1]);
+  char *out = slurp(fds[0]);
+  close(fds[0]);
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  res->wall = now() - start;
+  res->max_rss_kb = usage.ru_maxrss;
+  int ok = out && WIFEXITED(status) && WEXITSTATUS(status) == 0 && parse_output(out, res) == 0;
+  free(out);
+  if (!ok)
+  {
+    fprintf(stderr, "%s: simulator run failed\n", b->name);
+    return -1;
+  }
+  return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Median of v, which is left as it is
+static double median(const double *v, int n)
+{
+  double sorted[MAX_REPS];
+  memcpy(sorted, v, n * sizeof(double));
+  qsort(sorted, n, sizeof(double), cmp_double);
+  return n & 1 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+static double maximum(const double *v, int n)
+{
+  double max = v[0];
+  for (int i = 1; i < n; i++)
+    if (v[i] > max)
+      max = v[i];
+  return max;
+}
+
+// Baseline format, one benchmark per line ('#' starts a comment):
+//   name insns mips nt btfnt bimodal[4] gshare[4]
+static int read_baseline(const char *path, struct baseline *base, int max)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return 0;
+  char line[512];
+  int n = 0;
+  while (n < max && fgets(line, sizeof(line), f))
+  {
+    struct result *r = &base[n].res;
+    if (line[0] == '#' || line[0] == '\n')
+      continue;
+    if (sscanf(line, "%31s %ld %lf %ld %ld %ld %ld %ld %ld %ld %ld %ld %ld",
+               base[n].name, &r->insns, &r->mips, &r->nt_miss, &r->btfnt_miss,
+               &r->bimodal_miss[0], &r->bimodal_miss[1], &r->bimodal_miss[2], &r->bimodal_miss[3],
+               &r->gshare_miss[0], &r->gshare_miss[1], &r->gshare_miss[2], &r->gshare_miss[3]) == 13)
+      n++;
+  }
+  fclose(f);
+  return n;
+}
+
+static void write_baseline_line(FILE *f, const char *name, const struct result *r)
+{
+  fprintf(f, "%s %ld %.2f %ld %ld", name, r->insns, r->mips, r->nt_miss, r->btfnt_miss);
+  for (int i = 0; i < NUM_LEVELS; i++)
+    fprintf(f, " %ld", r->bimodal_miss[i]);
+  for (int i = 0; i < NUM_LEVELS; i++)
+    fprintf(f, " %ld", r->gshare_miss[i]);
+  fprintf(f, "\n");
+}
+
+static int same_results(const struct result *a, const struct result *b)
+{
+  if (a->insns != b->insns || a->nt_miss != b->nt_miss || a->btfnt_miss != b->btfnt_miss)
+    return 0;
+  for (int i = 0; i < NUM_LEVELS; i++)
+    if (a->bimodal_miss[i] != b->bimodal_miss[i] || a->gshare_miss[i] != b->gshare_miss[i])
+      return 0;
+  return 1;
+}
+
+static void print_count(long n)
+{
+  if (n < 0)
+    printf(" %12s", "n/a");
+  else
+    printf(" %12ld", n);
+}
+
+// Host dTLB misses and page faults with normal and huge page guest memory,
+// the minimum over the runs is reported for both
+static int compare_huge_pages(const char *sim, const char *dir, int reps)
+{
+  static const char *const small_opts[] = {"--host-perf", NULL};
+  static const char *const huge_opts[] = {"--host-perf", "--huge-pages", NULL};
+  printf("\n%-8s %12s %12s %8s %12s %12s\n",
+         "bench", "dTLB 64K", "dTLB huge", "change", "faults 64K", "faults huge");
+  for (int b = 0; b < NUM_BENCHMARKS; b++)
+  {
+    long min[2][2] = {{-1, -1}, {-1, -1}}; // [small/huge][dtlb/faults]
+    for (int r = 0; r < reps; r++)
+    {
+      for (int h = 0; h < 2; h++)
+      {
+        struct result res;
+        if (run_once(sim, dir, &benchmarks[b], h ? huge_opts : small_opts, &res))
+          return 1;
+        long v[2] = {res.dtlb_misses, res.page_faults};
+        for (int i = 0; i < 2; i++)
+          if (v[i] >= 0 && (min[h][i] < 0 || v[i] < min[h][i]))
+            min[h][i] = v[i];
+      }
+    }
+    printf("%-8s", benchmarks[b].name);
+    print_count(min[0][0]);
+    print_count(min[1][0]);
+    if (min[0][0] > 0 && min[1][0] >= 0)
+      printf(" %+7.1f%%", (min[1][0] * 100.0 / min[0][0]) - 100.0);
+    else
+      printf(" %8s", "-");
+    print_count(min[0][1]);
+    print_count(min[1][1]);
+    printf("\n");
+  }
+  return 0;
+}
+
+static void usage(void)
+{
+  printf("Usage: bench [options]\n");
+  printf("  -s sim        simulator binary (default ./sim)\n");
+  printf("  -d dir        benchmark directory (default ../predictor-benchmarks)\n");
+  printf("  -b file       baseline file (default bench/baseline.txt)\n");
+  printf("  -n reps       runs per benchmark (default 5)\n");
+  printf("  -t percent    allowed regression of the best-of-reps MIPS (default 10)\n");
+  printf("  -u            write the measured results as the new baseline\n");
+  printf("  -H            also compare host dTLB misses with and without --huge-pages\n");
+  exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *sim = "./sim";
+  const char *dir = "../predictor-benchmarks";
+  const char *baseline_path = "bench/baseline.txt";
+  int reps = 5;
+  double threshold = 10.0;
+  int update = 0;
+  int huge = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:d:b:n:t:uH")) != -1)
+  {
+    switch (opt)
+    {
+    case 's': sim = optarg; break;
+    case 'd': dir = optarg; break;
+    case 'b': baseline_path = optarg; break;
+    case 'n': reps = atoi(optarg); break;
+    case 't': threshold = atof(optarg); break;
+    case 'u': update = 1; break;
+    case 'H': huge = 1; break;
+    default: usage();
+    }
+  }
+  if (reps < 1 || reps > MAX_REPS)
+    usage();
+
+  struct baseline base[NUM_BENCHMARKS];
+  int num_base = update ? 0 : read_baseline(baseline_path, base, NUM_BENCHMARKS);
+  if (!update && num_base == 0)
+    printf("No baseline in %s, only reporting (run with -u to create one)\n", baseline_path);
+
+  struct result measured[NUM_BENCHMARKS];
+  int failed = 0;
+  printf("%-8s %12s %10s %10s %10s %10s  %s\n",
+         "bench", "insns", "best MIPS", "med MIPS", "wall s", "RSS KiB", "vs baseline");
+  for (int b = 0; b < NUM_BENCHMARKS; b++)
+  {
+    double mips[MAX_REPS], wall[MAX_REPS];
+    struct result runs[MAX_REPS];
+    long max_rss = 0;
+    for (int r = 0; r < reps; r++)
+    {
+      if (run_once(sim, dir, &benchmarks[b], NULL, &runs[r]))
+        return 1;
+      if (r > 0 && !same_results(&runs[0], &runs[r]))
+      {
+        printf("%s: results differ between runs\n", benchmarks[b].name);
+        failed = 1;
+      }
+      mips[r] = runs[r].mips;
+      wall[r] = runs[r].wall;
+      if (runs[r].max_rss_kb > max_rss)
+        max_rss = runs[r].max_rss_kb;
+    }
+    // Throughput is compared on the best run, which is far less sensitive to
+    // noise from other load on the host than the median.
+    struct result *m = &measured[b];
+    *m = runs[0];
+    double mips_median = median(mips, reps);
+    m->mips = maximum(mips, reps);
+    m->wall = median(wall, reps);
+    m->max_rss_kb = max_rss;
+
+    const struct baseline *ref = NULL;
+    for (int i = 0; i < num_base; i++)
+      if (!strcmp(base[i].name, benchmarks[b].name))
+        ref = &base[i];
+    char verdict[64] = "-";
+    if (ref)
+    {
+      double change = (m->mips / ref->res.mips - 1.0) * 100.0;
+      if (!same_results(m, &ref->res))
+      {
+        snprintf(verdict, sizeof(verdict), "RESULTS DIFFER");
+        failed = 1;
+      }
+      else if (change < -threshold)
+      {
+        snprintf(verdict, sizeof(verdict), "%+.1f%% REGRESSION", change);
+        failed = 1;
+      }
+      else
+        snprintf(verdict, sizeof(verdict), "%+.1f%%", change);
+    }
+    printf("%-8s %12ld %10.2f %10.2f %10.3f %10ld  %s\n",
+           benchmarks[b].name, m->insns, m->mips, mips_median, m->wall, m->max_rss_kb, verdict);
+    printf("         NT %ld  BTFNT %ld  bimodal", m->nt_miss, m->btfnt_miss);
+    for (int i = 0; i < NUM_LEVELS; i++)
+      printf(" %ld", m->bimodal_miss[i]);
+    printf("  gshare");
+    for (int i = 0; i < NUM_LEVELS; i++)
+      printf(" %ld", m->gshare_miss[i]);
+    printf("  (mispredictions)\n");
+  }
+
+  if (huge)
+    failed |= compare_huge_pages(sim, dir, reps);
+
+  if (update)
+  {
+    FILE *f = fopen(baseline_path, "w");
+    if (!f)
+    {
+      perror(baseline_path);
+      return 1;
+    }
+    fprintf(f, "# name insns mips nt btfnt bimodal256 bimodal1024 bimodal4096 bimodal16384"
+               " gshare256 gshare1024 gshare4096 gshare16384\n");
+    for (int b = 0; b < NUM_BENCHMARKS; b++)
+      write_baseline_line(f, benchmarks[b].name, &measured[b]);
+    fclose(f);
+    printf("Baseline written to %s\n", baseline_path);
+  }
+  return failed;
+}
@@ -0,0 +1,289 @@
+// Micro-benchmarks for the hot-path pieces of the simulator.
+//
+// Measures ns/op for the memory accessors under different access patterns,
+// the cost of touching a page for the first time, the immediate extractors
+// and the disassembler. Every benchmark is run for a number of warm-up
+// batches and then timed over several repetitions, reporting percentiles of
+// the per-batch ns/op so changes to memory.c and simulate.c can be judged in
+// isolation.
+//
+// Usage: microbench [-r reps] [-n ops-per-batch] [-e elf-for-symbols] [name-filter]
+
+#include "../memory.h"
+#include "../decode.h"
+#include "../disassemble.h"
+#include "../read_elf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_ADDRS 4096 // power of two, addresses are indexed with i & (NUM_ADDRS-1)
+#define WARMUP 3
+#define MAX_REPS 1000
+
+static volatile uint32_t sink; // keeps results alive
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Simple xorshift generator so runs are reproducible
+static uint32_t rng_state = 0x12345678;
+static uint32_t rng(void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+enum pattern
+{
+  SEQUENTIAL,
+  STRIDED,
+  RANDOM,
+  PAGE_CROSSING
+};
+static const char *pattern_names[] = {"seq", "stride", "random", "pagex"};
+
+// Fill addrs with NUM_ADDRS addresses of the given pattern, aligned to width
+static void make_addrs(uint32_t *addrs, enum pattern p, int width)
+{
+  const uint32_t base = 0x100000;
+  for (int i = 0; i < NUM_ADDRS; i++)
+  {
+    switch (p)
+    {
+    case SEQUENTIAL:
+      addrs[i] = base + i * width;
+      break;
+    case STRIDED: // 4 KiB plus a line, so every access hits a new host cache line
+      addrs[i] = base + i * (4096 + 64);
+      break;
+    case RANDOM: // anywhere within 16 MiB
+      addrs[i] = base + (rng() & 0xffffff & ~(width - 1));
+      break;
+    case PAGE_CROSSING: // every access lands in a different 64 KiB guest page
+      addrs[i] = base + (i & 255) * 0x10000 + ((i & 1) ? 0 : 0x10000 - width);
+      break;
+    }
+  }
+}
+
+struct bench_ctx
+{
+  struct memory *mem;
+  uint32_t addrs[NUM_ADDRS];
+  uint32_t insns[NUM_ADDRS];
+  struct symbols *symbols;
+};
+
+typedef void (*bench_fn)(struct bench_ctx *ctx, long n);
+
+#define MEM_READ_BENCH(name, fn)                            \
+  static void name(struct bench_ctx *ctx, long n)           \
+  {                                                         \
+    uint32_t sum = 0;                                       \
+    for (long i = 0; i < n; i++)                            \
+      sum += fn(ctx->mem, ctx->addrs[i & (NUM_ADDRS - 1)]); \
+    sink = sum;                                             \
+  }
+
+#define MEM_WRITE_BENCH(name, fn)                                  \
+  static void name(struct bench_ctx *ctx, long n)                  \
+  {                                                                \
+    for (long i = 0; i < n; i++)                                   \
+      fn(ctx->mem, ctx->addrs[i & (NUM_ADDRS - 1)], (int)i);       \
+  }
+
+MEM_READ_BENCH(bench_rd_w, memory_rd_w)
+MEM_READ_BENCH(bench_rd_h, memory_rd_h)
+MEM_READ_BENCH(bench_rd_b, memory_rd_b)
+MEM_WRITE_BENCH(bench_wr_w, memory_wr_w)
+MEM_WRITE_BENCH(bench_wr_h, memory_wr_h)
+MEM_WRITE_BENCH(bench_wr_b, memory_wr_b)
+
+#define IMM_BENCH(name, fn)                       \
+  static void name(struct bench_ctx *ctx, long n) \
+  {                                               \
+    uint32_t sum = 0;                             \
+    for (long i = 0; i < n; i++)                  \
+      sum += fn(ctx->insns[i & (NUM_ADDRS - 1)]); \
+    sink = sum;                                   \
+  }
+
+IMM_BENCH(bench_imm_I, imm_I)
+IMM_BENCH(bench_imm_S, imm_S)
+IMM_BENCH(bench_imm_B, imm_B)
+IMM_BENCH(bench_imm_U, imm_U)
+IMM_BENCH(bench_imm_J, imm_J)
+
+// First touch of a page: every op touches a page of a fresh memory, so every
+// access goes through the allocation in get_page(). The create/delete of the
+// memory is included and amortized over the ops of a batch.
+static void bench_page_miss(struct bench_ctx *ctx, long n)
+{
+  (void)ctx;
+  struct memory *mem = memory_create();
+  for (long i = 0; i < n; i++)
+    memory_wr_w(mem, (int)((i & 0xffff) << 16), 1);
+  memory_delete(mem);
+}
+
+static void bench_disassemble(struct bench_ctx *ctx, long n)
+{
+  char buf[100];
+  for (long i = 0; i < n; i++)
+  {
+    uint32_t idx = i & (NUM_ADDRS - 1);
+    disassemble(0x10000 + 4 * idx, ctx->insns[idx], buf, sizeof(buf), ctx->symbols);
+  }
+  sink = buf[0];
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p)
+{
+  int idx = (int)(p / 100.0 * (n - 1) + 0.5);
+  return sorted[idx];
+}
+
+static void run(const char *name, bench_fn fn, struct bench_ctx *ctx, long ops, int reps)
+{
+  static double samples[MAX_REPS];
+  for (int w = 0; w < WARMUP; w++)
+    fn(ctx, ops);
+  for (int r = 0; r < reps; r++)
+  {
+    double start = now_ns();
+    fn(ctx, ops);
+    samples[r] = (now_ns() - start) / ops;
+  }
+  qsort(samples, reps, sizeof(double), cmp_double);
+  printf("%-24s %10.2f %10.2f %10.2f %10.2f\n", name,
+         samples[0], percentile(samples, reps, 50), percentile(samples, reps, 90),
+         percentile(samples, reps, 99));
+}
+
+int main(int argc, char *argv[])
+{
+  int reps = 21;
+  long batch = 1 << 20;
+  const char *filter = NULL;
+  const char *elf = "../predictor-benchmarks/fib.elf";
+  int opt;
+  while ((opt = getopt(argc, argv, "r:n:e:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'r': reps = atoi(optarg); break;
+    case 'n': batch = atol(optarg); break;
+    case 'e': elf = optarg; break;
+    default:
+      printf("Usage: microbench [-r reps] [-n ops-per-batch] [-e elf-for-symbols] [filter]\n");
+      return -1;
+    }
+  }
+  if (optind < argc)
+    filter = argv[optind];
+  if (reps < 1 || reps > MAX_REPS || batch < 1)
+  {
+    printf("Bad repetition count or batch size\n");
+    return -1;
+  }
+
+  static struct bench_ctx ctx;
+  ctx.mem = memory_create();
+  for (int i = 0; i < NUM_ADDRS; i++)
+    ctx.insns[i] = rng();
+
+  const struct
+  {
+    const char *name;
+    bench_fn fn;
+  } mem_fns[] = {
+      {"rd_w", bench_rd_w}, {"rd_h", bench_rd_h}, {"rd_b", bench_rd_b},
+      {"wr_w", bench_wr_w}, {"wr_h", bench_wr_h}, {"wr_b", bench_wr_b},
+  };
+  const int widths[] = {4, 2, 1, 4, 2, 1};
+
+  printf("%-24s %10s %10s %10s %10s   (ns/op, %d reps of %ld ops)\n",
+         "benchmark", "min", "p50", "p90", "p99", reps, batch);
+  char name[64];
+  for (int f = 0; f < 6; f++)
+  {
+    for (int p = SEQUENTIAL; p <= PAGE_CROSSING; p++)
+    {
+      snprintf(name, sizeof(name), "memory_%s/%s", mem_fns[f].name, pattern_names[p]);
+      if (filter && !strstr(name, filter))
+        continue;
+      make_addrs(ctx.addrs, p, widths[f]);
+      // touch all pages first so the allocation is not part of the measurement
+      for (int i = 0; i < NUM_ADDRS; i++)
+        memory_wr_b(ctx.mem, ctx.addrs[i], 0);
+      run(name, mem_fns[f].fn, &ctx, batch, reps);
+    }
+  }
+
+  if (!filter || strstr("get_page/miss", filter))
+  {
+    // A page miss is expensive, so time fewer of them
+    run("get_page/miss", bench_page_miss, &ctx, 4096, reps);
+  }
+
+  const struct
+  {
+    const char *name;
+    bench_fn fn;
+  } imm_fns[] = {
+      {"imm_I", bench_imm_I}, {"imm_S", bench_imm_S}, {"imm_B", bench_imm_B},
+      {"imm_U", bench_imm_U}, {"imm_J", bench_imm_J},
+  };
+  for (int f = 0; f < 5; f++)
+  {
+    if (filter && !strstr(imm_fns[f].name, filter))
+      continue;
+    run(imm_fns[f].name, imm_fns[f].fn, &ctx, batch, reps);
+  }
+
+  // disassemble() is orders of magnitude slower than the rest, use smaller batches
+  long dis_batch = batch / 64 > 0 ? batch / 64 : 1;
+  if (!filter || strstr("disassemble", filter))
+  {
+    // a realistic instruction mix: the text segment of a benchmark program
+    struct program_info info;
+    struct memory *text = memory_create();
+    if (read_elf(text, &info, elf, stderr) == 0)
+    {
+      for (int i = 0; i < NUM_ADDRS; i++)
+      {
+        uint32_t addr = info.text_start + 4 * (i % ((info.text_end - info.text_start) / 4));
+        ctx.insns[i] = memory_rd_w(text, addr & ~3u);
+      }
+      ctx.symbols = NULL;
+      run("disassemble", bench_disassemble, &ctx, dis_batch, reps);
+      ctx.symbols = symbols_read_from_elf(elf);
+      if (ctx.symbols)
+      {
+        run("disassemble/symbols", bench_disassemble, &ctx, dis_batch, reps);
+        symbols_delete(ctx.symbols);
+      }
+    }
+    else
+      printf("disassemble: could not read %s, skipped\n", elf);
+    memory_delete(text);
+  }
+  memory_delete(ctx.mem);
+  return 0;
+}
@@ -0,0 +1,371 @@
+#include "block.h"
+#include "predict.h"
+#include "phaseprof.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Registers read or written by a plain op
+static uint32_t op_regs(int op, int rd, int rs1, int rs2){
+    if ((op >= OP_ADD && op <= OP_REMU))
+        return (1u << rd) | (1u << rs1) | (1u << rs2);
+    if ((op >= OP_ADDI && op <= OP_LHU) || op == OP_JALR)
+        return (1u << rd) | (1u << rs1);
+    if ((op >= OP_SB && op <= OP_BNEVER))
+        return (1u << rs1) | (1u << rs2);
+    if (op == OP_JAL || op == OP_LUI || op == OP_AUIPC)
+        return 1u << rd;
+    if (op == OP_ECALL)
+        return ~0u;
+    return 0;
+}
+
+static uint32_t insn_regs(const struct decoded_insn *d){
+    if (!is_fused(d->op))
+        return op_regs(d->op, d->rd, d->rs1, d->rs2);
+    return op_regs(d->op1, d->rd, d->rs1, d->rs2) | op_regs(d->op2, d->rd2, d->rs1_2, d->rs2_2);
+}
+
+static int is_terminator(int op){
+    return (op >= OP_BEQ && op <= OP_JALR) || op == OP_ECALL || op == OP_ILLEGAL || op == OP_BREAKPOINT ||
+           op == OP_AUIPC_JALR || (op >= OP_ADDI_BRANCH && op <= OP_ALU_BRANCH) ||
+           op == OP_CALL || op == OP_RET;
+}
+
+// Rewrite a plain op to its sp/ra form where there is one
+static void specialize(struct decoded_insn *d){
+    switch (d->op) {
+        case OP_LW:
+            if (d->rs1 == 2 && d->rd == 1) d->op = OP_LW_RA_SP;
+            else if (d->rs1 == 2 && d->rd != 0 && d->rd != 2) d->op = OP_LW_SP;
+            break;
+        case OP_SW:
+            if (d->rs1 == 2 && d->rs2 == 1) d->op = OP_SW_RA_SP;
+            else if (d->rs1 == 2 && d->rs2 != 2) d->op = OP_SW_SP;
+            break;
+        case OP_ADDI:
+            if (d->rd == 2 && d->rs1 == 2) d->op = OP_ADDI_SP;
+            break;
+        case OP_JAL:
+            if (d->rd == 1) d->op = OP_CALL;
+            break;
+        case OP_JALR:
+            if (d->rd == 0 && d->rs1 == 1) d->op = OP_RET;
+            break;
+    }
+    if (d->op < OP_LW_SP && (insn_regs(d) & BLOCK_CACHED_REGS))
+        d->flags |= BLOCK_SYNC;
+    if ((d->op >= OP_SB && d->op <= OP_SW) || d->op == OP_SW_SW)
+        d->flags |= BLOCK_STORE;
+}
+
+// Chunk index ---------------------------------------------------------------
+
+static void add_ref(struct block_cache *bc, struct block *b, uint32_t chunk){
+    for (struct chunk_ref *r = b->refs; r; r = r->sibling)
+        if (r->chunk == chunk)
+            return;
+    struct chunk_ref *r = malloc(sizeof(struct chunk_ref));
+    struct chunk_ref **head = &bc->chunks[chunk & (BLOCK_CHUNK_TABLE_SIZE - 1)];
+    r->chunk = chunk;
+    r->b = b;
+    r->next = *head;
+    r->prev = head;
+    if (*head)
+        (*head)->prev = &r->next;
+    *head = r;
+    r->sibling = b->refs;
+    b->refs = r;
+}
+
+// add b to the lists of the chunks its entries are in
+static void index_block(struct block_cache *bc, struct block *b){
+    uint32_t pc = b->pc;
+    for (int i = 0; i < b->len; i++) {
+        if (b->exits)
+            pc = b->exits[i].pc;
+        int n = is_fused(b->insns[i].op) ? 2 : 1;
+        add_ref(bc, b, pc / MEMORY_CODE_CHUNK);
+        add_ref(bc, b, (pc + 4 * n - 1) / MEMORY_CODE_CHUNK);
+        pc += 4 * n;
+    }
+}
+
+static void unindex_block(struct block *b){
+    struct chunk_ref *r = b->refs;
+    while (r) {
+        struct chunk_ref *sibling = r->sibling;
+        *r->prev = r->next;
+        if (r->next)
+            r->next->prev = r->prev;
+        free(r);
+        r = sibling;
+    }
+    b->refs = NULL;
+}
+
+// Block cache -----------------------------------------------------------------
+
+struct block_cache *block_cache_create(struct memory *mem){
+    struct block_cache *bc = calloc(1, sizeof(struct block_cache));
+    bc->dc = decode_cache_create(mem, 1);
+    return bc;
+}
+
+static void free_chain(struct block *b){
+    while (b) {
+        struct block *next = b->next;
+        free(b->trace);
+        free(b);
+        b = next;
+    }
+}
+
+void block_cache_delete(struct block_cache *bc){
+    for (int i = 0; i < BLOCK_TABLE_SIZE; i++)
+        free_chain(bc->table[i]);
+    for (int i = 0; i < BLOCK_CHUNK_TABLE_SIZE; i++) {
+        struct chunk_ref *r = bc->chunks[i];
+        while (r) {
+            struct chunk_ref *next = r->next;
+            free(r);
+            r = next;
+        }
+    }
+    free_chain(bc->dead);
+    decode_cache_delete(bc->dc);
+    free(bc);
+}
+
+struct block *block_build(struct block_cache *bc, uint32_t pc){
+    struct decoded_insn insns[BLOCK_MAX_INSNS];
+    free_chain(bc->dead);
+    bc->dead = NULL;
+    int len = 0, ninsns = 0, nfused = 0;
+    uint32_t p = pc;
+    int done = 0;
+    while (!done) {
+        struct decoded_insn d = *decode_cache_lookup(bc->dc, p);
+        // a breakpoint is a block of its own that executes no instructions
+        if (d.op == OP_BREAKPOINT && len > 0)
+            break;
+        int phase = sim_phase;
+        SET_PHASE(PHASE_DECODE);
+        if (is_fused(d.op) && (insn_regs(&d) & BLOCK_CACHED_REGS)) {
+            // Superinstructions using sp or ra are split so both halves can
+            // be specialized; the second half is looked up on its own
+            d.op = d.op1;
+        }
+        int n = is_fused(d.op) ? 2 : d.op == OP_BREAKPOINT ? 0 : 1;
+        specialize(&d);
+        insns[len++] = d;
+        ninsns += n;
+        if (n == 2)
+            nfused += 2;
+        p += 4 * n;
+        done = is_terminator(d.op) || len == BLOCK_MAX_INSNS || (p & 0xffff) == 0;
+        SET_PHASE(phase);
+    }
+
+    struct block *b = calloc(1, sizeof(struct block) + len * sizeof(struct decoded_insn));
+    b->pc = pc;
+    b->len = len;
+    b->ninsns = ninsns;
+    b->nfused = nfused;
+    memcpy(b->insns, insns, len * sizeof(struct decoded_insn));
+    struct block **head = &bc->table[(pc >> 2) & (BLOCK_TABLE_SIZE - 1)];
+    b->next = *head;
+    *head = b;
+    index_block(bc, b);
+    bc->num_blocks++;
+    return b;
+}
+
+// Where the last entry d at pc of a block leads to along the predicted path.
+// fallthrough is the pc after the block. Returns 0 for indirect jumps and
+// anything else that cannot be followed, and sets *guard for conditional
+// branches.
+static int successor(const struct decoded_insn *d, uint32_t pc, uint32_t fallthrough,
+                     uint32_t *next, int *guard){
+    uint32_t branch_pc = pc;
+    int32_t imm = d->imm;
+    int op = d->op;
+    *guard = 0;
+    if (op >= OP_ADDI_BRANCH && op <= OP_ALU_BRANCH) {
+        branch_pc = pc + 4;
+        imm = d->imm2;
+        op = d->op2;
+    }
+    if (op >= OP_BEQ && op <= OP_BNEVER) {
+        int size = bimodal_sizes[BIMODAL_LEVELS - 1];
+        int taken = op != OP_BNEVER && bimodal[BIMODAL_LEVELS - 1][(branch_pc >> 2) & (size - 1)] >= 2;
+        *next = taken ? branch_pc + imm : fallthrough;
+        *guard = 1;
+        return 1;
+    }
+    if (op == OP_JAL || op == OP_CALL) {
+        *next = pc + imm;
+        return 1;
+    }
+    if (!is_terminator(op)) {
+        *next = fallthrough;
+        return 1;
+    }
+    return 0;
+}
+
+struct block *trace_form(struct block_cache *bc, struct block *head){
+    struct decoded_insn insns[TRACE_MAX_INSNS];
+    struct trace_exit exits[TRACE_MAX_INSNS + 1];
+    struct block *seen[TRACE_MAX_BLOCKS];
+    int len = 0, num_seen = 0, ninsns = 0, nfused = 0;
+    int closed = 0;
+    struct block *b = head;
+    int phase = sim_phase;
+    SET_PHASE(PHASE_DECODE);
+    for (;;) {
+        if (len + b->len > TRACE_MAX_INSNS || num_seen == TRACE_MAX_BLOCKS)
+            break;
+        for (int i = 0; i < num_seen; i++)
+            if (seen[i] == b)
+                goto done;
+        if (b->insns[0].op == OP_BREAKPOINT)
+            break;
+        seen[num_seen++] = b;
+
+        uint32_t pc = b->pc;
+        for (int i = 0; i < b->len; i++) {
+            int n = is_fused(b->insns[i].op) ? 2 : 1;
+            insns[len] = b->insns[i];
+            ninsns += n;
+            if (n == 2)
+                nfused += 2;
+            exits[len].pc = pc;
+            exits[len].ninsns = ninsns;
+            exits[len].nfused = nfused;
+            len++;
+            pc += 4 * n;
+        }
+
+        uint32_t next;
+        int guard;
+        if (!successor(&insns[len - 1], exits[len - 1].pc, pc, &next, &guard)) {
+            exits[len].pc = 0;
+            break;
+        }
+        if (guard)
+            insns[len - 1].flags |= BLOCK_GUARD;
+        exits[len].pc = next;
+        if (next == head->pc) {
+            closed = 1;
+            break;
+        }
+        if (next & 3)
+            break;
+        b = block_lookup(bc, next);
+    }
+done:
+    SET_PHASE(phase);
+    if (!closed && num_seen < 2)
+        return NULL;
+
+    struct block *t = calloc(1, sizeof(struct block) + len * sizeof(struct decoded_insn) +
+                                (len + 1) * sizeof(struct trace_exit));
+    t->pc = head->pc;
+    t->len = len;
+    t->ninsns = ninsns;
+    t->nfused = nfused;
+    memcpy(t->insns, insns, len * sizeof(struct decoded_insn));
+    t->exits = (struct trace_exit *)&t->insns[len];
+    memcpy(t->exits, exits, (len + 1) * sizeof(struct trace_exit));
+    t->head = head;
+    index_block(bc, t);
+    head->trace = t;
+    bc->num_traces++;
+    return t;
+}
+
+void trace_retire(struct block *head){
+    unindex_block(head->trace);
+    free(head->trace);
+    head->trace = NULL;
+    head->heat = 0;
+}
+
+// does an entry of b hold an instruction in [addr, addr + size)
+static int block_overlaps(const struct block *b, uint32_t addr, uint32_t size){
+    uint32_t pc = b->pc;
+    for (int i = 0; i < b->len; i++) {
+        if (b->exits)
+            pc = b->exits[i].pc;
+        int n = is_fused(b->insns[i].op) ? 2 : 1;
+        if (pc + 4 * n > addr && pc < addr + size)
+            return 1;
+        pc += 4 * n;
+    }
+    return 0;
+}
+
+// Move the trace of head to the dead list
+static void kill_trace(struct block_cache *bc, struct block *head){
+    struct block *t = head->trace;
+    unindex_block(t);
+    t->next = bc->dead;
+    bc->dead = t;
+    head->trace = NULL;
+    head->heat = 0;
+}
+
+// Remove b, a block or trace with written code, from the cache
+static void kill_block(struct block_cache *bc, struct block *b){
+    b->stale = 1;
+    if (b->exits) {
+        kill_trace(bc, b->head);
+        return;
+    }
+    if (b->trace)
+        kill_trace(bc, b);
+    struct block **p = &bc->table[(b->pc >> 2) & (BLOCK_TABLE_SIZE - 1)];
+    while (*p != b)
+        p = &(*p)->next;
+    *p = b->next;
+    unindex_block(b);
+    b->next = bc->dead;
+    bc->dead = b;
+}
+
+void block_cache_invalidate(struct block_cache *bc, uint32_t addr, uint32_t size){
+    decode_cache_invalidate(bc->dc, addr, size);
+    uint32_t last = (addr + size - 1) / MEMORY_CODE_CHUNK;
+    for (uint32_t chunk = addr / MEMORY_CODE_CHUNK; chunk <= last; chunk++) {
+        struct chunk_ref **list = &bc->chunks[chunk & (BLOCK_CHUNK_TABLE_SIZE - 1)];
+        struct chunk_ref *r = *list;
+        while (r) {
+            if (r->chunk == chunk && block_overlaps(r->b, addr, size)) {
+                kill_block(bc, r->b);
+                r = *list;  // killing may have taken more than r off the list
+            } else {
+                r = r->next;
+            }
+        }
+    }
+}
+
+void block_prefix(const struct block *b, int i, int *ninsns, int *nfused){
+    *ninsns = *nfused = 0;
+    if (b->exits) {
+        if (i > 0) {
+            *ninsns = b->exits[i - 1].ninsns;
+            *nfused = b->exits[i - 1].nfused;
+        }
+        return;
+    }
+    for (int j = 0; j < i; j++) {
+        if (is_fused(b->insns[j].op)) {
+            *ninsns += 2;
+            *nfused += 2;
+        } else if (b->insns[j].op != OP_BREAKPOINT) {
+            *ninsns += 1;
+        }
+    }
+}
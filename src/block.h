@@ -0,0 +1,114 @@
+#ifndef __BLOCK_H__
+#define __BLOCK_H__
+
+#include "decode.h"
+#include <stdint.h>
+
+// Basic blocks for the block engine: straight-line runs of predecoded
+// instructions ending at the first control transfer, ecall or illegal
+// instruction (or after BLOCK_MAX_INSNS entries or at a page boundary).
+//
+// Inside a block sp and ra are kept in host registers. Loads and stores
+// relative to sp, sp adjustments, calls and returns are rewritten to forms
+// that use them directly (OP_LW_SP ... OP_RET); any other entry that reads
+// or writes sp or ra is marked BLOCK_SYNC and sees them through R[].
+
+#define BLOCK_MAX_INSNS 64
+#define BLOCK_TABLE_SIZE 0x10000    // power of two
+#define BLOCK_CHUNK_TABLE_SIZE 0x1000   // power of two
+
+// decoded_insn.flags in blocks
+#define BLOCK_SYNC 1    // spill sp/ra to R[] before the entry, reload after
+#define BLOCK_GUARD 2   // traces: side exit unless the entry continues to the next one
+#define BLOCK_STORE 4   // a store not relative to sp
+
+// Traces: once the target of a backward branch has been reached TRACE_HOT
+// times, the blocks along the most likely path from it are joined into one
+// trace, following each conditional branch in the direction the largest
+// bimodal predictor table currently predicts. Those branches become guards
+// that leave the trace when they go the other way. Traces that mostly side
+// exit are dropped so they can be formed again along the current path.
+#define TRACE_HOT 64
+#define TRACE_MAX_INSNS 256
+#define TRACE_MAX_BLOCKS 32
+#define TRACE_RETIRE_RUNS 256   // runs before a trace may be dropped
+
+// per trace entry: its pc and the guest instructions executed through it
+struct trace_exit {
+    uint32_t pc;
+    uint16_t ninsns;
+    uint16_t nfused;
+};
+
+// registers held in host registers inside a block
+#define BLOCK_CACHED_REGS ((1u << 1) | (1u << 2))
+
+// A block or trace with code in a code chunk of memory (MEMORY_CODE_CHUNK),
+// so block_cache_invalidate only visits the blocks of the written chunk
+struct chunk_ref {
+    struct chunk_ref *next, **prev;     // in the list of the chunk
+    struct chunk_ref *sibling;          // next one of the same block
+    uint32_t chunk;
+    struct block *b;
+};
+
+struct block {
+    struct block *next;     // hash chain
+    uint32_t pc;
+    int len;                // entries in insns
+    int ninsns;             // guest instructions (superinstructions count twice)
+    int nfused;             // guest instructions executed in superinstructions
+    long heat;              // times reached by a backward branch
+    struct block *trace;    // trace starting at this block, if formed
+    int stale;              // invalidated, its code has been written
+    struct chunk_ref *refs; // the chunks it has code in
+
+    // traces only: exits[i] for each entry, exits[len].pc is where the trace
+    // continues after its last entry
+    struct trace_exit *exits;
+    struct block *head;     // the block it starts at
+    long runs;
+    long side_exits;
+
+    struct decoded_insn insns[];
+};
+
+struct block_cache {
+    struct block *table[BLOCK_TABLE_SIZE];
+    struct chunk_ref *chunks[BLOCK_CHUNK_TABLE_SIZE];   // by chunk number
+    struct decode_cache *dc;
+    struct block *dead;     // invalidated blocks and traces, freed by block_build
+    long num_blocks;
+    long num_traces;        // traces formed, including dropped ones
+};
+
+struct block_cache *block_cache_create(struct memory *mem);
+void block_cache_delete(struct block_cache *bc);
+
+// build the block starting at pc and add it to the cache
+struct block *block_build(struct block_cache *bc, uint32_t pc);
+
+// form a trace starting at head, returns NULL if there is no useful one
+struct block *trace_form(struct block_cache *bc, struct block *head);
+
+// drop the trace of head
+void trace_retire(struct block *head);
+
+// Remove blocks and traces with code in [addr, addr + size) after it was
+// written, found through the chunks they have code in. The engine may be executing one of them, so they are only freed
+// by the next block_build, which the engine never calls mid-block, and
+// marked stale: the engine leaves a stale block right after the store.
+void block_cache_invalidate(struct block_cache *bc, uint32_t addr, uint32_t size);
+
+// guest instructions, and those of them in superinstructions, executed by
+// the entries of b before entry i
+void block_prefix(const struct block *b, int i, int *ninsns, int *nfused);
+
+static inline struct block *block_lookup(struct block_cache *bc, uint32_t pc){
+    struct block *b = bc->table[(pc >> 2) & (BLOCK_TABLE_SIZE - 1)];
+    while (b && b->pc != pc)
+        b = b->next;
+    return b ? b : block_build(bc, pc);
+}
+
+#endif
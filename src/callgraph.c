@@ -0,0 +1,180 @@
+#include "callgraph.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const char *callgraph_metric_names[NUM_CALLGRAPH_METRICS] = {
+    "insns", "mispredicts", "host-ns"
+};
+
+// A node per call path. Children are created after their parent, so a node's
+// index is always larger than its parent's.
+struct cg_node {
+    uint32_t func;
+    int parent;
+    int first_child;
+    int next_sibling;
+    long calls;
+    long self[NUM_CALLGRAPH_METRICS];
+    long total[NUM_CALLGRAPH_METRICS];  // filled in when writing
+};
+
+struct cg_frame {
+    int node;
+    uint32_t return_addr;
+};
+
+struct callgraph {
+    struct cg_node *nodes;
+    int num_nodes;
+    int max_nodes;
+    struct cg_frame *stack;
+    int depth;          // frames above the root
+    int max_depth;
+    // running totals when the current node was last charged
+    long last[NUM_CALLGRAPH_METRICS];
+};
+
+static long host_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int new_node(struct callgraph *cg, int parent, uint32_t func)
+{
+    if (cg->num_nodes == cg->max_nodes) {
+        cg->max_nodes = cg->max_nodes ? 2 * cg->max_nodes : 256;
+        cg->nodes = realloc(cg->nodes, cg->max_nodes * sizeof(struct cg_node));
+    }
+    int n = cg->num_nodes++;
+    struct cg_node *node = &cg->nodes[n];
+    memset(node, 0, sizeof(*node));
+    node->func = func;
+    node->parent = parent;
+    node->first_child = -1;
+    node->next_sibling = -1;
+    if (parent >= 0) {
+        node->next_sibling = cg->nodes[parent].first_child;
+        cg->nodes[parent].first_child = n;
+    }
+    return n;
+}
+
+// Charge what happened since the last call or return to the current node
+static void charge(struct callgraph *cg, long insns, const struct Stat *stats)
+{
+    long now[NUM_CALLGRAPH_METRICS] = {
+        insns, stats->gshare_mispredictions[3], host_ns()
+    };
+    struct cg_node *node = &cg->nodes[cg->stack[cg->depth].node];
+    for (int m = 0; m < NUM_CALLGRAPH_METRICS; m++) {
+        node->self[m] += now[m] - cg->last[m];
+        cg->last[m] = now[m];
+    }
+}
+
+struct callgraph *callgraph_create(uint32_t entry)
+{
+    struct callgraph *cg = calloc(1, sizeof(struct callgraph));
+    cg->max_depth = 64;
+    cg->stack = malloc(cg->max_depth * sizeof(struct cg_frame));
+    cg->stack[0].node = new_node(cg, -1, entry);
+    cg->stack[0].return_addr = 0;
+    cg->nodes[0].calls = 1;
+    cg->last[CALLGRAPH_HOST_NS] = host_ns();
+    return cg;
+}
+
+void callgraph_call(struct callgraph *cg, uint32_t target, uint32_t return_addr,
+                    long insns, const struct Stat *stats)
+{
+    charge(cg, insns, stats);
+    int parent = cg->stack[cg->depth].node;
+    int child = cg->nodes[parent].first_child;
+    while (child >= 0 && cg->nodes[child].func != target)
+        child = cg->nodes[child].next_sibling;
+    if (child < 0)
+        child = new_node(cg, parent, target);
+    cg->nodes[child].calls++;
+    if (++cg->depth == cg->max_depth) {
+        cg->max_depth *= 2;
+        cg->stack = realloc(cg->stack, cg->max_depth * sizeof(struct cg_frame));
+    }
+    cg->stack[cg->depth].node = child;
+    cg->stack[cg->depth].return_addr = return_addr;
+}
+
+void callgraph_return(struct callgraph *cg, uint32_t target, long insns, const struct Stat *stats)
+{
+    int d = cg->depth;
+    while (d > 0 && cg->stack[d].return_addr != target)
+        d--;
+    if (d == 0)
+        return;     // not a return to a known frame, just a jump
+    charge(cg, insns, stats);
+    cg->depth = d - 1;
+}
+
+static void put_path(FILE *f, struct callgraph *cg, int n, struct symbols *symbols)
+{
+    if (cg->nodes[n].parent >= 0) {
+        put_path(f, cg, cg->nodes[n].parent, symbols);
+        fputc(';', f);
+    }
+    const char *name = symbols_value_to_sym(symbols, cg->nodes[n].func);
+    if (name)
+        fputs(name, f);
+    else
+        fprintf(f, "0x%08x", cg->nodes[n].func);
+}
+
+int callgraph_write(struct callgraph *cg, const struct Stat *final, struct symbols *symbols,
+                    enum callgraph_metric metric, const char *folded, const char *report)
+{
+    charge(cg, final->insns, final);
+    for (int n = 0; n < cg->num_nodes; n++)
+        memcpy(cg->nodes[n].total, cg->nodes[n].self, sizeof(cg->nodes[n].total));
+    for (int n = cg->num_nodes - 1; n > 0; n--)
+        for (int m = 0; m < NUM_CALLGRAPH_METRICS; m++)
+            cg->nodes[cg->nodes[n].parent].total[m] += cg->nodes[n].total[m];
+
+    FILE *f = fopen(folded, "w");
+    if (!f)
+        return -1;
+    for (int n = 0; n < cg->num_nodes; n++) {
+        if (cg->nodes[n].self[metric] > 0) {
+            put_path(f, cg, n, symbols);
+            fprintf(f, " %ld\n", cg->nodes[n].self[metric]);
+        }
+    }
+    if (fclose(f))
+        return -1;
+    if (!report)
+        return 0;
+
+    f = fopen(report, "w");
+    if (!f)
+        return -1;
+    fprintf(f, "path\tcalls");
+    for (int m = 0; m < NUM_CALLGRAPH_METRICS; m++)
+        fprintf(f, "\tincl_%s\texcl_%s", callgraph_metric_names[m], callgraph_metric_names[m]);
+    fputc('\n', f);
+    for (int n = 0; n < cg->num_nodes; n++) {
+        put_path(f, cg, n, symbols);
+        fprintf(f, "\t%ld", cg->nodes[n].calls);
+        for (int m = 0; m < NUM_CALLGRAPH_METRICS; m++)
+            fprintf(f, "\t%ld\t%ld", cg->nodes[n].total[m], cg->nodes[n].self[m]);
+        fputc('\n', f);
+    }
+    return fclose(f) ? -1 : 0;
+}
+
+void callgraph_delete(struct callgraph *cg)
+{
+    free(cg->nodes);
+    free(cg->stack);
+    free(cg);
+}
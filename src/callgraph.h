@@ -0,0 +1,48 @@
+#ifndef __CALLGRAPH_H__
+#define __CALLGRAPH_H__
+
+#include "simulate.h"
+#include <stdint.h>
+
+// Call-graph profile. A shadow call stack follows the guest's calls (jal and
+// jalr writing ra or t0) and returns (jalr x0 through ra or t0 to the return
+// address of a frame on the stack, popping the frames above it too). Every
+// distinct call path gets a node, which collects the instructions, the
+// mispredictions of the largest gShare predictor and the host time spent in
+// it, exclusive of its callees. The counts are taken from running totals at
+// each call and return, so the cost is per call rather than per instruction.
+// Tail calls (jumps not writing a link register) stay in the caller's node.
+//
+// The reference interpreter maintains the stack, so a run with a call-graph
+// profile runs on ENGINE_SWITCH.
+
+enum callgraph_metric {
+    CALLGRAPH_INSNS,
+    CALLGRAPH_MISPREDICTS,
+    CALLGRAPH_HOST_NS,
+    NUM_CALLGRAPH_METRICS
+};
+
+extern const char *callgraph_metric_names[NUM_CALLGRAPH_METRICS];
+
+struct callgraph;
+
+// entry is the function the program starts in, the root of every path
+struct callgraph *callgraph_create(uint32_t entry);
+
+// insns is the instruction count including the call or return
+void callgraph_call(struct callgraph *cg, uint32_t target, uint32_t return_addr,
+                    long insns, const struct Stat *stats);
+void callgraph_return(struct callgraph *cg, uint32_t target, long insns, const struct Stat *stats);
+
+// Write the profile as folded stacks ("main;fib;fib 1234" per path, the
+// input of flamegraph.pl) with the exclusive metric as value, functions
+// named by their symbols. With report set, also write a tab separated table
+// of every path with its calls and the inclusive and exclusive values of
+// every metric. Returns 0 on success.
+int callgraph_write(struct callgraph *cg, const struct Stat *final, struct symbols *symbols,
+                    enum callgraph_metric metric, const char *folded, const char *report);
+
+void callgraph_delete(struct callgraph *cg);
+
+#endif
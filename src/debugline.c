@@ -0,0 +1,452 @@
+#include "debugline.h"
+#include "elf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// DWARF constants used here (DWARF 5, section 6.2)
+#define DW_LNS_copy 1
+#define DW_LNS_advance_pc 2
+#define DW_LNS_advance_line 3
+#define DW_LNS_set_file 4
+#define DW_LNS_const_add_pc 8
+#define DW_LNS_fixed_advance_pc 9
+#define DW_LNE_end_sequence 1
+#define DW_LNE_set_address 2
+#define DW_LNE_define_file 3
+#define DW_LNCT_path 1
+#define DW_LNCT_directory_index 2
+#define DW_FORM_block 0x09
+#define DW_FORM_block1 0x0a
+#define DW_FORM_data1 0x0b
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_data8 0x07
+#define DW_FORM_data16 0x1e
+#define DW_FORM_string 0x08
+#define DW_FORM_strp 0x0e
+#define DW_FORM_line_strp 0x1f
+#define DW_FORM_udata 0x0f
+
+// A row starts a range of addresses on one line. Line 0 ends a sequence:
+// the addresses from there to the next row belong to no line.
+struct line_row {
+    uint32_t addr;
+    uint32_t line;
+    uint32_t file;      // index into files
+    uint32_t order;     // of the rows, rows at the same address keep it
+};
+
+struct line_table {
+    struct line_row *rows;
+    int num_rows;
+    int max_rows;
+    char **files;
+    int num_files;
+    int max_files;
+};
+
+// A section, or the part of one being read. Reads past the end return
+// zeros and set the error flag instead of failing at every call site.
+struct cursor {
+    const uint8_t *p, *end;
+    int error;
+};
+
+static const uint8_t *take(struct cursor *c, uint64_t n)
+{
+    if (c->error || (uint64_t)(c->end - c->p) < n) {
+        c->error = 1;
+        c->p = c->end;
+        return NULL;
+    }
+    const uint8_t *at = c->p;
+    c->p += n;
+    return at;
+}
+
+static uint64_t get_u(struct cursor *c, int n)
+{
+    const uint8_t *p = take(c, n);
+    uint64_t v = 0;
+    for (int i = n - 1; p && i >= 0; i--)
+        v = v << 8 | p[i];
+    return v;
+}
+
+static uint64_t get_uleb(struct cursor *c)
+{
+    uint64_t v = 0;
+    int shift = 0;
+    const uint8_t *p;
+    do {
+        p = take(c, 1);
+        if (p && shift < 64)
+            v |= (uint64_t)(*p & 0x7f) << shift;
+        shift += 7;
+    } while (p && (*p & 0x80));
+    return v;
+}
+
+static int64_t get_sleb(struct cursor *c)
+{
+    int64_t v = 0;
+    int shift = 0;
+    const uint8_t *p;
+    do {
+        p = take(c, 1);
+        if (p && shift < 64)
+            v |= (int64_t)(*p & 0x7f) << shift;
+        shift += 7;
+    } while (p && (*p & 0x80));
+    if (p && shift < 64 && (*p & 0x40))
+        v |= -((int64_t)1 << shift);
+    return v;
+}
+
+static const char *get_string(struct cursor *c)
+{
+    const uint8_t *s = c->p;
+    while (c->p < c->end && *c->p)
+        c->p++;
+    if (take(c, 1) == NULL)
+        return "";
+    return (const char *)s;
+}
+
+// ELF input ---------------------------------------------------------------
+
+struct sections {
+    uint8_t *line, *line_str, *str;
+    uint32_t line_size, line_str_size, str_size;
+};
+
+static uint8_t *read_at(FILE *f, uint32_t offset, uint32_t size)
+{
+    uint8_t *data = malloc(size ? size : 1);
+    if (fseek(f, offset, SEEK_SET) || fread(data, 1, size, f) != size) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+static int read_sections(const char *file_name, struct sections *s)
+{
+    memset(s, 0, sizeof(*s));
+    FILE *f = fopen(file_name, "rb");
+    if (!f)
+        return -1;
+    Elf32_Ehdr eh;
+    Elf32_Shdr *sh = NULL;
+    char *names = NULL;
+    if (fread(&eh, sizeof(eh), 1, f) != 1 || memcmp(eh.e_ident, ELFMAG, SELFMAG)
+        || eh.e_shnum == 0 || eh.e_shstrndx >= eh.e_shnum
+        || !(sh = (Elf32_Shdr *)read_at(f, eh.e_shoff, eh.e_shnum * sizeof(Elf32_Shdr)))
+        || !(names = (char *)read_at(f, sh[eh.e_shstrndx].sh_offset, sh[eh.e_shstrndx].sh_size))) {
+        free(sh);
+        fclose(f);
+        return -1;
+    }
+    uint32_t names_size = sh[eh.e_shstrndx].sh_size;
+    for (int i = 0; i < eh.e_shnum; i++) {
+        if (sh[i].sh_name >= names_size || sh[i].sh_type == SHT_NOBITS)
+            continue;
+        const char *name = names + sh[i].sh_name;
+        uint8_t **data = !strcmp(name, ".debug_line") ? &s->line
+                       : !strcmp(name, ".debug_line_str") ? &s->line_str
+                       : !strcmp(name, ".debug_str") ? &s->str : NULL;
+        uint32_t *size = data == &s->line ? &s->line_size
+                       : data == &s->line_str ? &s->line_str_size : &s->str_size;
+        if (data && !*data) {
+            *data = read_at(f, sh[i].sh_offset, sh[i].sh_size);
+            *size = *data ? sh[i].sh_size : 0;
+        }
+    }
+    free(names);
+    free(sh);
+    fclose(f);
+    return s->line ? 0 : -1;
+}
+
+// Line programs -----------------------------------------------------------
+
+static void add_row(struct line_table *t, uint32_t addr, uint32_t line, uint32_t file)
+{
+    if (t->num_rows == t->max_rows) {
+        t->max_rows = t->max_rows ? 2 * t->max_rows : 256;
+        t->rows = realloc(t->rows, t->max_rows * sizeof(struct line_row));
+    }
+    t->rows[t->num_rows] = (struct line_row){addr, line, file, (uint32_t)t->num_rows};
+    t->num_rows++;
+}
+
+static int add_file(struct line_table *t, const char *dir, const char *name)
+{
+    if (t->num_files == t->max_files) {
+        t->max_files = t->max_files ? 2 * t->max_files : 16;
+        t->files = realloc(t->files, t->max_files * sizeof(char *));
+    }
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(len);
+    if (dir[0] && name[0] != '/')
+        snprintf(path, len, "%s/%s", dir, name);
+    else
+        snprintf(path, len, "%s", name);
+    t->files[t->num_files] = path;
+    return t->num_files++;
+}
+
+static const char *string_at(const uint8_t *section, uint32_t size, uint64_t offset)
+{
+    if (!section || offset >= size || !memchr(section + offset, 0, size - offset))
+        return "";
+    return (const char *)section + offset;
+}
+
+// Value of an entry field in a DWARF 5 directory or file name table. Strings
+// are returned in *str, numbers as the result; other forms are skipped.
+static uint64_t get_form(struct cursor *c, uint64_t form, int offset_size,
+                         const struct sections *s, const char **str)
+{
+    *str = NULL;
+    switch (form) {
+    case DW_FORM_string: *str = get_string(c); return 0;
+    case DW_FORM_line_strp: *str = string_at(s->line_str, s->line_str_size, get_u(c, offset_size)); return 0;
+    case DW_FORM_strp: *str = string_at(s->str, s->str_size, get_u(c, offset_size)); return 0;
+    case DW_FORM_udata: return get_uleb(c);
+    case DW_FORM_data1: return get_u(c, 1);
+    case DW_FORM_data2: return get_u(c, 2);
+    case DW_FORM_data4: return get_u(c, 4);
+    case DW_FORM_data8: return get_u(c, 8);
+    case DW_FORM_data16: take(c, 16); return 0;
+    case DW_FORM_block: take(c, get_uleb(c)); return 0;
+    case DW_FORM_block1: take(c, get_u(c, 1)); return 0;
+    default: c->error = 1; return 0;
+    }
+}
+
+// Read a DWARF 5 directory or file name table. names[i] gets the path and
+// dirs[i] the directory index of entry i.
+static int read_entries(struct cursor *c, int offset_size, const struct sections *s,
+                        const char ***names, uint64_t **dirs)
+{
+    int num_formats = get_u(c, 1);
+    uint64_t formats[2 * 16];
+    if (num_formats > 16) {
+        c->error = 1;
+        return 0;
+    }
+    for (int i = 0; i < 2 * num_formats; i++)
+        formats[i] = get_uleb(c);
+    uint64_t count = get_uleb(c);
+    if (count > (uint64_t)(c->end - c->p)) {
+        c->error = 1;
+        return 0;
+    }
+    *names = calloc(count + 1, sizeof(char *));
+    *dirs = calloc(count + 1, sizeof(uint64_t));
+    for (uint64_t e = 0; e < count && !c->error; e++) {
+        (*names)[e] = "";
+        for (int i = 0; i < num_formats; i++) {
+            const char *str;
+            uint64_t v = get_form(c, formats[2 * i + 1], offset_size, s, &str);
+            if (formats[2 * i] == DW_LNCT_path && str)
+                (*names)[e] = str;
+            else if (formats[2 * i] == DW_LNCT_directory_index)
+                (*dirs)[e] = v;
+        }
+    }
+    return (int)count;
+}
+
+// Run the line program of one unit, the cursor covering exactly that unit
+static void read_unit(struct line_table *t, struct cursor *c, int offset_size, const struct sections *s)
+{
+    int version = get_u(c, 2);
+    if (version < 2 || version > 5)
+        return;
+    if (version >= 5)
+        take(c, 2);     // address_size, segment_selector_size
+    uint64_t header_length = get_u(c, offset_size);
+    if (header_length > (uint64_t)(c->end - c->p))
+        return;
+    struct cursor program = {c->p + header_length, c->end, 0};
+    int min_insn_length = get_u(c, 1);
+    if (version >= 4)
+        get_u(c, 1);    // maximum_operations_per_instruction, 1 for RISC-V
+    get_u(c, 1);        // default_is_stmt
+    int line_base = (int8_t)get_u(c, 1);
+    int line_range = get_u(c, 1);
+    int opcode_base = get_u(c, 1);
+    const uint8_t *opcode_lengths = take(c, opcode_base > 0 ? opcode_base - 1 : 0);
+    if (c->error || line_range == 0 || opcode_base == 0)
+        return;
+
+    // The unit's files, as indices into t->files. Before DWARF 5 file 1 is
+    // the first entry and file 0 is unused.
+    int *files = NULL;
+    int num_files = 0, first_file;
+    if (version >= 5) {
+        const char **dir_names = NULL, **file_names = NULL;
+        uint64_t *unused = NULL, *file_dirs = NULL;
+        int num_dirs = read_entries(c, offset_size, s, &dir_names, &unused);
+        num_files = c->error ? 0 : read_entries(c, offset_size, s, &file_names, &file_dirs);
+        files = calloc(num_files + 1, sizeof(int));
+        for (int i = 0; i < num_files && !c->error; i++)
+            files[i] = add_file(t, file_dirs[i] < (uint64_t)num_dirs ? dir_names[file_dirs[i]] : "",
+                                file_names[i]);
+        free(dir_names);
+        free(unused);
+        free(file_names);
+        free(file_dirs);
+        first_file = 0;
+    } else {
+        const char *dir_names[256];
+        int num_dirs = 1;
+        dir_names[0] = "";
+        for (const char *d; *(d = get_string(c)) && !c->error; )
+            if (num_dirs < 256)
+                dir_names[num_dirs++] = d;
+        for (const char *name; *(name = get_string(c)) && !c->error; ) {
+            uint64_t dir = get_uleb(c);
+            get_uleb(c);    // modification time
+            get_uleb(c);    // length
+            files = realloc(files, (num_files + 1) * sizeof(int));
+            files[num_files++] = add_file(t, dir < (uint64_t)num_dirs ? dir_names[dir] : "", name);
+        }
+        first_file = 1;
+    }
+    if (c->error) {
+        free(files);
+        return;
+    }
+
+    uint64_t addr = 0, file = 1, line = 1;
+    int no_file = add_file(t, "", "?");
+#define FILE_INDEX (file - first_file < (uint64_t)num_files ? files[file - first_file] : no_file)
+    while (program.p < program.end && !program.error) {
+        int op = get_u(&program, 1);
+        if (op >= opcode_base) {
+            int adjusted = op - opcode_base;
+            addr += (adjusted / line_range) * min_insn_length;
+            line += line_base + adjusted % line_range;
+            add_row(t, (uint32_t)addr, (uint32_t)line, FILE_INDEX);
+            continue;
+        }
+        switch (op) {
+        case 0: {
+            uint64_t len = get_uleb(&program);
+            const uint8_t *start = program.p;
+            int sub = len ? (int)get_u(&program, 1) : -1;
+            if (sub == DW_LNE_end_sequence) {
+                add_row(t, (uint32_t)addr, 0, 0);
+                addr = 0;
+                file = 1;
+                line = 1;
+            } else if (sub == DW_LNE_set_address && len >= 2 && len <= 9) {
+                addr = get_u(&program, len - 1);
+            } else if (sub == DW_LNE_define_file) {
+                const char *name = get_string(&program);
+                get_uleb(&program);
+                files = realloc(files, (num_files + 1) * sizeof(int));
+                files[num_files++] = add_file(t, "", name);
+            }
+            program.p = start;
+            take(&program, len);
+            break;
+        }
+        case DW_LNS_copy:
+            add_row(t, (uint32_t)addr, (uint32_t)line, FILE_INDEX);
+            break;
+        case DW_LNS_advance_pc:
+            addr += get_uleb(&program) * min_insn_length;
+            break;
+        case DW_LNS_advance_line:
+            line += get_sleb(&program);
+            break;
+        case DW_LNS_set_file:
+            file = get_uleb(&program);
+            break;
+        case DW_LNS_const_add_pc:
+            addr += ((255 - opcode_base) / line_range) * min_insn_length;
+            break;
+        case DW_LNS_fixed_advance_pc:
+            addr += get_u(&program, 2);
+            break;
+        default:
+            // the rest only change state not kept here, skip their operands
+            for (int i = 0; i < opcode_lengths[op - 1]; i++)
+                get_uleb(&program);
+        }
+    }
+#undef FILE_INDEX
+    free(files);
+}
+
+static int compare_rows(const void *a, const void *b)
+{
+    const struct line_row *x = a, *y = b;
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    // a sequence ending where another starts yields to the start
+    if ((x->line != 0) != (y->line != 0))
+        return x->line != 0 ? 1 : -1;
+    return x->order < y->order ? -1 : 1;
+}
+
+struct line_table *line_table_read(const char *file_name)
+{
+    struct sections s;
+    if (read_sections(file_name, &s)) {
+        free(s.line_str);
+        free(s.str);
+        return NULL;
+    }
+    struct line_table *t = calloc(1, sizeof(struct line_table));
+    struct cursor c = {s.line, s.line + s.line_size, 0};
+    while (c.p < c.end && !c.error) {
+        int offset_size = 4;
+        uint64_t length = get_u(&c, 4);
+        if (length == 0xffffffff) {
+            offset_size = 8;
+            length = get_u(&c, 8);
+        }
+        const uint8_t *unit = take(&c, length);
+        if (!unit)
+            break;
+        struct cursor u = {unit, unit + length, 0};
+        read_unit(t, &u, offset_size, &s);
+    }
+    free(s.line);
+    free(s.line_str);
+    free(s.str);
+    qsort(t->rows, t->num_rows, sizeof(struct line_row), compare_rows);
+    return t;
+}
+
+int line_table_lookup(const struct line_table *t, uint32_t addr, const char **file)
+{
+    // last row at or before addr
+    int lo = 0, hi = t->num_rows;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (t->rows[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0 || t->rows[lo - 1].line == 0)
+        return 0;
+    *file = t->files[t->rows[lo - 1].file];
+    return t->rows[lo - 1].line;
+}
+
+void line_table_delete(struct line_table *t)
+{
+    for (int i = 0; i < t->num_files; i++)
+        free(t->files[i]);
+    free(t->files);
+    free(t->rows);
+    free(t);
+}
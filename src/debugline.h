@@ -0,0 +1,21 @@
+#ifndef __DEBUGLINE_H__
+#define __DEBUGLINE_H__
+
+#include <stdint.h>
+
+// Address to source line table from the DWARF line programs (.debug_line,
+// versions 2 to 5) of an ELF file. The line programs are run once when the
+// table is read, giving rows sorted by address that are binary searched.
+
+struct line_table;
+
+// NULL if the file has no .debug_line section (or it cannot be read)
+struct line_table *line_table_read(const char *file_name);
+
+// Line of the instruction at addr, with its file (as "dir/name") in *file.
+// Returns 0 if no line program covers addr.
+int line_table_lookup(const struct line_table *t, uint32_t addr, const char **file);
+
+void line_table_delete(struct line_table *t);
+
+#endif
@@ -0,0 +1,304 @@
+#include "decode.h"
+#include "memory.h"
+#include "phaseprof.h"
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+void decode_insn(uint32_t instruction, struct decoded_insn *d){
+    uint32_t opcode = instruction & 0x7f;
+    uint32_t funct3 = (instruction >> 12) & 0x7;
+    uint32_t funct7 = (instruction >> 25) & 0x7f;
+
+    d->op = OP_ILLEGAL;
+    d->rd = (instruction >> 7) & 0x1f;
+    d->rs1 = (instruction >> 15) & 0x1f;
+    d->rs2 = (instruction >> 20) & 0x1f;
+    d->imm = (int32_t)instruction;
+    d->op1 = d->op2 = d->rd2 = d->rs1_2 = d->rs2_2 = d->flags = 0;
+    d->imm2 = 0;
+
+    switch (opcode){
+        case 0x33: {
+            static const uint8_t muldiv[8] = {
+                OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU
+            };
+            // Like the reference interpreter, funct7 only matters for
+            // add/sub and srl/sra; the other ops ignore it.
+            static const uint8_t alu[8] = {
+                OP_ADD, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_OR, OP_AND
+            };
+            if (funct7 == 0x01)
+                d->op = muldiv[funct3];
+            else if (funct3 == 0x0)
+                d->op = funct7 == 0x00 ? OP_ADD : funct7 == 0x20 ? OP_SUB : OP_BAD_FUNCT7;
+            else if (funct3 == 0x5)
+                d->op = funct7 == 0x00 ? OP_SRL : funct7 == 0x20 ? OP_SRA : OP_NOP;
+            else
+                d->op = alu[funct3];
+            break;
+        }
+        case 0x13: {
+            static const uint8_t alu_imm[8] = {
+                OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU, OP_XORI, OP_SRLI, OP_ORI, OP_ANDI
+            };
+            d->op = alu_imm[funct3];
+            if (funct3 == 0x1 || funct3 == 0x5){
+                d->imm = (instruction >> 20) & 0x1f;
+                if (funct3 == 0x5 && funct7 != 0x00)
+                    d->op = OP_SRAI;
+            } else {
+                d->imm = imm_I(instruction);
+            }
+            break;
+        }
+        case 0x03: {
+            static const uint8_t loads[8] = {
+                OP_LB, OP_LH, OP_LW, OP_NOP, OP_LBU, OP_LHU, OP_NOP, OP_NOP
+            };
+            d->op = loads[funct3];
+            d->imm = imm_I(instruction);
+            break;
+        }
+        case 0x23: {
+            static const uint8_t stores[8] = {
+                OP_SB, OP_SH, OP_SW, OP_NOP, OP_NOP, OP_NOP, OP_NOP, OP_NOP
+            };
+            d->op = stores[funct3];
+            d->imm = imm_S(instruction);
+            break;
+        }
+        case 0x63: {
+            static const uint8_t branches[8] = {
+                OP_BEQ, OP_BNE, OP_BNEVER, OP_BNEVER, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU
+            };
+            d->op = branches[funct3];
+            d->imm = imm_B(instruction);
+            break;
+        }
+        case 0x6f:
+            d->op = OP_JAL;
+            d->imm = imm_J(instruction);
+            break;
+        case 0x67:
+            d->op = OP_JALR;
+            d->imm = imm_I(instruction);
+            break;
+        case 0x37:
+            d->op = OP_LUI;
+            d->imm = imm_U(instruction);
+            break;
+        case 0x17:
+            d->op = OP_AUIPC;
+            d->imm = imm_U(instruction);
+            break;
+        case 0x73:
+            d->op = instruction == 0x00000073 ? OP_ECALL : OP_BAD_SYSTEM;
+            break;
+    }
+}
+
+static int is_branch(int op){
+    return op >= OP_BEQ && op <= OP_BNEVER;
+}
+
+// ops that only write rd from registers and/or an immediate
+static int is_alu(int op){
+    return (op >= OP_ADD && op <= OP_AND) || (op >= OP_ADDI && op <= OP_SRAI);
+}
+
+int fuse_insns(struct decoded_insn *first, const struct decoded_insn *second){
+    int a = first->op, b = second->op;
+    int fused = 0;
+
+    // The pair is executed in program order, so the only requirement for
+    // exact results is that the first instruction does not write x0, which
+    // the engines would otherwise have to clear in between.
+    if (first->rd == 0 && a != OP_SW)
+        return 0;
+
+    if (a == OP_LUI && b == OP_ADDI && second->rd == first->rd && second->rs1 == first->rd)
+        fused = OP_LUI_ADDI;
+    else if (a == OP_AUIPC && b == OP_ADDI && second->rd == first->rd && second->rs1 == first->rd)
+        fused = OP_AUIPC_ADDI;
+    else if (a == OP_AUIPC && b == OP_JALR && second->rs1 == first->rd)
+        fused = OP_AUIPC_JALR;
+    else if (a == OP_SLLI && b == OP_ADD && (second->rs1 == first->rd || second->rs2 == first->rd))
+        fused = OP_SLLI_ADD;
+    else if (a == OP_ADDI && is_branch(b))
+        fused = OP_ADDI_BRANCH;
+    else if (a == OP_ADD && is_branch(b))
+        fused = OP_ADD_BRANCH;
+    else if (is_alu(a) && is_branch(b))
+        fused = OP_ALU_BRANCH;
+    else if (a == OP_LW && b == OP_LW)
+        fused = OP_LW_LW;
+    else if (a == OP_SW && b == OP_SW)
+        fused = OP_SW_SW;
+
+    if (!fused)
+        return 0;
+    first->op1 = a;
+    first->op2 = b;
+    first->rd2 = second->rd;
+    first->rs1_2 = second->rs1;
+    first->rs2_2 = second->rs2;
+    first->imm2 = second->imm;
+    first->op = fused;
+    return 1;
+}
+
+struct decode_cache *decode_cache_create(struct memory *mem, int fuse){
+    struct decode_cache *dc = calloc(1, sizeof(struct decode_cache));
+    dc->mem = mem;
+    dc->fuse = fuse;
+    return dc;
+}
+
+void decode_cache_delete(struct decode_cache *dc){
+    for (int i = 0; i < 0x10000; i++)
+        free(dc->pages[i]);
+    free(dc);
+}
+
+struct decoded_insn *decode_cache_new_page(struct decode_cache *dc, uint32_t pc){
+    struct decoded_insn **page = &dc->pages[pc >> 16];
+    *page = calloc(DECODE_PAGE_INSNS, sizeof(struct decoded_insn));
+    return *page;
+}
+
+static int is_breakpoint(const struct decode_cache *dc, uint32_t pc){
+    for (int i = 0; i < dc->num_breakpoints; i++)
+        if (dc->breakpoints[i] == pc)
+            return 1;
+    return 0;
+}
+
+// Decode the entry at pc, fused with the next instruction if it can be.
+// Only reads memory, so the pages of pc and pc + 4 must exist when this runs
+// on several threads (memory_rd_w would allocate a missing one).
+static int decode_entry(struct decode_cache *dc, uint32_t pc, struct decoded_insn *d){
+    decode_insn((uint32_t)memory_rd_w(dc->mem, pc), d);
+    if (is_breakpoint(dc, pc)) {
+        d->op = OP_BREAKPOINT;
+        return 0;
+    }
+    if (!dc->fuse || (pc & 0xffff) == 0xfffc || is_breakpoint(dc, pc + 4))
+        return 0;
+    // The second instruction is decoded again here rather than looked up
+    // so fusing never depends on which entries happen to be decoded.
+    struct decoded_insn next;
+    decode_insn((uint32_t)memory_rd_w(dc->mem, pc + 4), &next);
+    fuse_insns(d, &next);
+    return 1;
+}
+
+void decode_cache_fill(struct decode_cache *dc, uint32_t pc, struct decoded_insn *d){
+    int phase = sim_phase;
+    SET_PHASE(PHASE_DECODE);
+    if (pc & 3)
+        memory_misaligned_fetch(dc->mem, (int)pc);
+    // stores into decoded code must come back to decode_cache_invalidate
+    memory_mark_code(dc->mem, (int)pc);
+    if (decode_entry(dc, pc, d))
+        memory_mark_code(dc->mem, (int)pc + 4);
+    SET_PHASE(phase);
+}
+
+// Prefilling --------------------------------------------------------------
+
+#define PREFILL_CHUNK 0x10000   // instructions per thread at least
+#define PREFILL_THREADS 16
+
+struct prefill_part {
+    struct decode_cache *dc;
+    uint32_t start, end;
+};
+
+static void *prefill_part(void *arg){
+    struct prefill_part *part = arg;
+    for (uint32_t pc = part->start; pc != part->end; pc += 4)
+        decode_entry(part->dc, pc, &part->dc->pages[pc >> 16][(pc >> 2) & (DECODE_PAGE_INSNS - 1)]);
+    return NULL;
+}
+
+// Target of a (fused) branch or jal at pc, or pc if it has none
+static uint32_t branch_target(const struct decoded_insn *d, uint32_t pc){
+    if (d->op == OP_JAL || is_branch(d->op))
+        return pc + d->imm;
+    if (is_fused(d->op) && is_branch(d->op2))
+        return pc + 4 + d->imm2;
+    return pc;
+}
+
+void decode_cache_prefill(struct decode_cache *dc, uint32_t start, uint32_t end){
+    start = (start + 3) & ~3u;
+    end &= ~3u;
+    if (start >= end)
+        return;
+    int phase = sim_phase;
+    SET_PHASE(PHASE_DECODE);
+    // Everything the threads share is set up first: the decode cache pages,
+    // the memory pages (the last entry reads one word past end to fuse) and
+    // the code marks.
+    for (uint32_t pc = start; pc - start <= end - start; pc = (pc | (MEMORY_CODE_CHUNK - 1)) + 1) {
+        if (!dc->pages[pc >> 16])
+            decode_cache_new_page(dc, pc);
+        memory_rd_w(dc->mem, pc);
+        memory_mark_code(dc->mem, (int)pc);
+    }
+
+    uint32_t insns = (end - start) / 4;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = insns / PREFILL_CHUNK;
+    if (threads > cpus)
+        threads = cpus;
+    if (threads > PREFILL_THREADS)
+        threads = PREFILL_THREADS;
+    if (threads < 1)
+        threads = 1;
+    struct prefill_part parts[PREFILL_THREADS];
+    pthread_t ids[PREFILL_THREADS];
+    int started[PREFILL_THREADS];
+    for (int i = 0; i < threads; i++) {
+        parts[i].dc = dc;
+        parts[i].start = start + 4 * (uint32_t)((uint64_t)insns * i / threads);
+        parts[i].end = start + 4 * (uint32_t)((uint64_t)insns * (i + 1) / threads);
+    }
+    for (int i = 1; i < threads; i++)
+        started[i] = pthread_create(&ids[i], NULL, prefill_part, &parts[i]) == 0;
+    prefill_part(&parts[0]);
+    for (int i = 1; i < threads; i++) {
+        if (started[i])
+            pthread_join(ids[i], NULL);
+        else
+            prefill_part(&parts[i]);
+    }
+
+    // Direct branch and jump targets outside the range are decoded too
+    for (uint32_t pc = start; pc != end; pc += 4) {
+        uint32_t target = branch_target(&dc->pages[pc >> 16][(pc >> 2) & (DECODE_PAGE_INSNS - 1)], pc);
+        if ((target < start || target >= end) && !(target & 3))
+            decode_cache_lookup(dc, target);
+    }
+    SET_PHASE(phase);
+}
+
+void decode_cache_invalidate(struct decode_cache *dc, uint32_t addr, uint32_t size){
+    // both ends aligned, so the loop ends even when the range wraps around
+    uint32_t end = (addr + size + 3) & ~3u;
+    for (uint32_t pc = (addr - 4) & ~3u; pc != end; pc += 4) {
+        struct decoded_insn *page = dc->pages[pc >> 16];
+        if (page)
+            page[(pc >> 2) & (DECODE_PAGE_INSNS - 1)].op = OP_UNDECODED;
+    }
+}
+
+void decode_cache_set_breakpoints(struct decode_cache *dc, const uint32_t *pcs, int num){
+    for (int i = 0; i < dc->num_breakpoints; i++)
+        decode_cache_invalidate(dc, dc->breakpoints[i], 4);
+    dc->breakpoints = pcs;
+    dc->num_breakpoints = num;
+    for (int i = 0; i < num; i++)
+        decode_cache_invalidate(dc, pcs[i], 4);
+}
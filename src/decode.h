@@ -0,0 +1,171 @@
+#ifndef __DECODE_H__
+#define __DECODE_H__
+
+#include <stdint.h>
+
+struct memory;
+
+// Instruction field helpers shared by the simulator and the disassembler
+
+// Sign-extend helpers
+static inline int32_t sign_extend(uint32_t v, int bits){
+    // Extend n-bit value to 32-bit signed integer
+    uint32_t m = 1u << (bits - 1);
+    int32_t result = (int32_t)v;
+    if (v & m){
+        result -= (int32_t)(2 * m);  // Subtracting 2*m to get negative value
+    }
+    return result;
+}
+
+// Immediate extraction helpers
+static inline int32_t imm_I(uint32_t instruct){ // I-type
+    return sign_extend(instruct >> 20, 12);
+}
+
+static inline int32_t imm_S(uint32_t instruct){ // S-type
+    uint32_t imm = ((instruct >> 25) << 5) | ((instruct >> 7) & 0x1f);
+    return sign_extend(imm, 12); // 12 bits including sign bit
+}
+
+static inline int32_t imm_B(uint32_t instruct){ // B-type
+    uint32_t imm = ((instruct >> 31) & 0x1) << 12;
+    imm |= (((instruct >> 25) & 0x3f) << 5);
+    imm |= (((instruct >> 8) & 0xf) << 1);
+    imm |= (((instruct >> 7) & 0x1) << 11);
+    return sign_extend(imm, 13); // 13 bits including sign bit
+}
+
+static inline int32_t imm_U(uint32_t instruct){ // U-type
+    return (int32_t)(instruct & 0xfffff000u);
+}
+
+static inline int32_t imm_J(uint32_t instruct){ // J-type
+    uint32_t imm = 0;
+    imm |= (((instruct >> 31) & 0x1) << 20);
+    imm |= (((instruct >> 21) & 0x3ff) << 1);
+    imm |= (((instruct >> 20) & 0x1) << 11);
+    imm |= (((instruct >> 12) & 0xff) << 12);
+    return sign_extend(imm, 21); // 21 bits including sign bit
+}
+
+// Predecoded instructions -------------------------------------------------
+
+// Operations of predecoded instructions. OP_UNDECODED marks a decode cache
+// entry that has not been decoded yet. Encodings the reference interpreter
+// treats specially get their own ops so all engines behave the same.
+enum op {
+    OP_UNDECODED,
+    OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA, OP_OR, OP_AND,
+    OP_MUL, OP_MULH, OP_MULHSU, OP_MULHU, OP_DIV, OP_DIVU, OP_REM, OP_REMU,
+    OP_ADDI, OP_SLTI, OP_SLTIU, OP_XORI, OP_ORI, OP_ANDI, OP_SLLI, OP_SRLI, OP_SRAI,
+    OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU,
+    OP_SB, OP_SH, OP_SW,
+    OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+    OP_BNEVER,          // conditional branch with reserved funct3: never taken
+    OP_JAL, OP_JALR, OP_LUI, OP_AUIPC,
+    OP_ECALL,
+    OP_NOP,             // no architectural effect (e.g. load with reserved funct3)
+    OP_BAD_FUNCT7,      // add/sub with unknown funct7: reported, no effect
+    OP_BAD_SYSTEM,      // system instruction other than ecall: reported, no effect
+    OP_ILLEGAL,         // unknown opcode: reported, stops the simulation
+    OP_BREAKPOINT,      // breakpoint patched over the instruction: stops before it
+
+    // Superinstructions: two consecutive instructions executed by one handler.
+    // op1 holds the op of the first and op2/rd2/rs1_2/rs2_2/imm2 the second.
+    OP_FIRST_FUSED,
+    OP_LUI_ADDI = OP_FIRST_FUSED,   // lui rd,U; addi rd,rd,I
+    OP_AUIPC_ADDI,                  // auipc rd,U; addi rd,rd,I
+    OP_AUIPC_JALR,                  // auipc rd,U; jalr rd2,I(rd)
+    OP_SLLI_ADD,                    // slli rd,rs,sh; add rd2,rd,rs | add rd2,rs,rd
+    OP_ADDI_BRANCH,                 // addi; conditional branch
+    OP_ADD_BRANCH,                  // add; conditional branch
+    OP_ALU_BRANCH,                  // other register/immediate ALU op; conditional branch
+    OP_LW_LW,                       // two loads, e.g. restoring saved registers
+    OP_SW_SW,                       // two stores, e.g. saving registers
+    OP_LAST_FUSED = OP_SW_SW,
+
+    // Forms used only inside blocks of the block engine, where sp and ra
+    // are held in host registers (see block.h)
+    OP_LW_SP,       // lw rd,I(sp), rd not sp/ra
+    OP_SW_SP,       // sw rs2,I(sp), rs2 not sp/ra
+    OP_LW_RA_SP,    // lw ra,I(sp)
+    OP_SW_RA_SP,    // sw ra,I(sp)
+    OP_ADDI_SP,     // addi sp,sp,I
+    OP_CALL,        // jal ra,J
+    OP_RET,         // jalr x0,I(ra)
+    NUM_OPS
+};
+
+struct decoded_insn {
+    uint8_t op;         // enum op
+    uint8_t rd, rs1, rs2;
+    int32_t imm;        // immediate, shift amount, or the raw instruction for reported ops
+    uint8_t op1;        // superinstructions: op of the first instruction
+    uint8_t op2, rd2, rs1_2;
+    uint8_t rs2_2;
+    uint8_t flags;      // engine specific
+    int32_t imm2;
+};
+
+static inline int is_fused(int op){
+    return op >= OP_FIRST_FUSED && op <= OP_LAST_FUSED;
+}
+
+// decode one instruction word into d (plain op, never a superinstruction)
+void decode_insn(uint32_t instruction, struct decoded_insn *d);
+
+// Try to turn first into a superinstruction with the instruction that
+// follows it. Returns 1 if the pair was fused.
+int fuse_insns(struct decoded_insn *first, const struct decoded_insn *second);
+
+// Decode cache: decoded instructions for every executed word, one lazily
+// allocated array per 64 KiB page, the same granularity as struct memory.
+// Entries are decoded the first time they are executed.
+#define DECODE_PAGE_INSNS 0x4000
+
+struct decode_cache {
+    struct decoded_insn *pages[0x10000];
+    struct memory *mem;
+    int fuse;           // build superinstructions
+    const uint32_t *breakpoints;    // pcs decoded as OP_BREAKPOINT
+    int num_breakpoints;
+};
+
+struct decode_cache *decode_cache_create(struct memory *mem, int fuse);
+void decode_cache_delete(struct decode_cache *dc);
+
+// slow paths of decode_cache_lookup
+struct decoded_insn *decode_cache_new_page(struct decode_cache *dc, uint32_t pc);
+void decode_cache_fill(struct decode_cache *dc, uint32_t pc, struct decoded_insn *d);
+
+// forget the instructions in [addr, addr + size) after they were written,
+// including a superinstruction that starts just before. Entries are only
+// marked undecoded, so one that is executing stays intact.
+void decode_cache_invalidate(struct decode_cache *dc, uint32_t addr, uint32_t size);
+
+// Decode every word in [start, end) now, on several threads if the range is
+// large, and the targets of direct branches and jumps in it that lie
+// outside, instead of each on its first execution. Exactly the entries the
+// lazy decoding would produce, words that are never executed are decoded
+// (and marked as code) in vain.
+void decode_cache_prefill(struct decode_cache *dc, uint32_t start, uint32_t end);
+
+// Replace the breakpoints. The list is not copied. Entries at the old and
+// new breakpoints are invalidated, so anything built from the cache (like
+// blocks) must be invalidated there too.
+void decode_cache_set_breakpoints(struct decode_cache *dc, const uint32_t *pcs, int num);
+
+// decoded instruction at pc, decoding it if needed (a misaligned pc takes
+// the slow path, which fails the same way as a fetch from memory)
+static inline struct decoded_insn *decode_cache_lookup(struct decode_cache *dc, uint32_t pc){
+    struct decoded_insn *page = dc->pages[pc >> 16];
+    if (!page)
+        page = decode_cache_new_page(dc, pc);
+    struct decoded_insn *d = &page[(pc >> 2) & (DECODE_PAGE_INSNS - 1)];
+    if (d->op == OP_UNDECODED || (pc & 3))
+        decode_cache_fill(dc, pc, d);
+    return d;
+}
+
+#endif
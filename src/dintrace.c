@@ -0,0 +1,134 @@
+#include "dintrace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+// The buffer is a ring of chunks filled in order by the simulator and
+// written in order by the writer. full counts the chunks waiting to be
+// written, empty the chunks the simulator may fill next.
+#define DIN_CHUNKS 8
+#define DIN_CHUNK_RECORDS (1 << 17)     // 1 MiB per chunk
+
+struct din_writer {
+    FILE *out;
+    enum din_format format;
+    uint64_t *chunks[DIN_CHUNKS];
+    long counts[DIN_CHUNKS];
+    int last[DIN_CHUNKS];       // the final chunk, the writer stops after it
+    int current;                // being filled by the simulator
+    sem_t full, empty;
+    pthread_t thread;
+    int error;
+};
+
+static size_t format_text(const uint64_t *records, long n, char *buf)
+{
+    static const char hex[] = "0123456789abcdef";
+    char *p = buf;
+    for (long i = 0; i < n; i++) {
+        uint32_t addr = (uint32_t)records[i];
+        *p++ = '0' + (int)(records[i] >> 32);
+        *p++ = ' ';
+        int shift = 28;
+        while (shift > 0 && !(addr >> shift))
+            shift -= 4;
+        for (; shift >= 0; shift -= 4)
+            *p++ = hex[(addr >> shift) & 0xf];
+        *p++ = '\n';
+    }
+    return p - buf;
+}
+
+static size_t format_binary(const uint64_t *records, long n, char *buf)
+{
+    char *p = buf;
+    for (long i = 0; i < n; i++) {
+        uint32_t addr = (uint32_t)records[i];
+        *p++ = (char)(records[i] >> 32);
+        for (int b = 0; b < 4; b++)
+            *p++ = (char)(addr >> (8 * b));
+    }
+    return p - buf;
+}
+
+static void *writer_main(void *arg)
+{
+    struct din_writer *w = arg;
+    // "2 ffffffff\n" is the longest line
+    char *buf = malloc(DIN_CHUNK_RECORDS * 11);
+    for (int idx = 0; ; idx = (idx + 1) % DIN_CHUNKS) {
+        sem_wait(&w->full);
+        size_t len = w->format == DIN_TEXT ? format_text(w->chunks[idx], w->counts[idx], buf)
+                                           : format_binary(w->chunks[idx], w->counts[idx], buf);
+        if (fwrite(buf, 1, len, w->out) != len)
+            w->error = 1;
+        if (w->last[idx])
+            break;
+        sem_post(&w->empty);
+    }
+    free(buf);
+    return NULL;
+}
+
+struct dintrace *dintrace_open(const char *path, enum din_format format)
+{
+    FILE *out = fopen(path, "wb");
+    if (!out)
+        return NULL;
+    struct din_writer *w = calloc(1, sizeof(struct din_writer));
+    w->out = out;
+    w->format = format;
+    for (int i = 0; i < DIN_CHUNKS; i++)
+        w->chunks[i] = malloc(DIN_CHUNK_RECORDS * sizeof(uint64_t));
+    sem_init(&w->full, 0, 0);
+    sem_init(&w->empty, 0, DIN_CHUNKS - 1);
+    if (pthread_create(&w->thread, NULL, writer_main, w)) {
+        fclose(out);
+        for (int i = 0; i < DIN_CHUNKS; i++)
+            free(w->chunks[i]);
+        free(w);
+        return NULL;
+    }
+    struct dintrace *d = calloc(1, sizeof(struct dintrace));
+    d->writer = w;
+    d->on = 1;
+    d->pos = w->chunks[0];
+    d->end = w->chunks[0] + DIN_CHUNK_RECORDS;
+    return d;
+}
+
+static void hand_over(struct dintrace *d, int last)
+{
+    struct din_writer *w = d->writer;
+    w->counts[w->current] = d->pos - w->chunks[w->current];
+    w->last[w->current] = last;
+    sem_post(&w->full);
+    if (last)
+        return;
+    sem_wait(&w->empty);
+    w->current = (w->current + 1) % DIN_CHUNKS;
+    d->pos = w->chunks[w->current];
+    d->end = d->pos + DIN_CHUNK_RECORDS;
+}
+
+void dintrace_flush(struct dintrace *d)
+{
+    hand_over(d, 0);
+}
+
+int dintrace_close(struct dintrace *d)
+{
+    struct din_writer *w = d->writer;
+    hand_over(d, 1);
+    pthread_join(w->thread, NULL);
+    int error = w->error | (fclose(w->out) != 0);
+    sem_destroy(&w->full);
+    sem_destroy(&w->empty);
+    for (int i = 0; i < DIN_CHUNKS; i++)
+        free(w->chunks[i]);
+    free(w);
+    free(d);
+    return error ? -1 : 0;
+}
@@ -0,0 +1,73 @@
+#ifndef __DINTRACE_H__
+#define __DINTRACE_H__
+
+#include <stdint.h>
+
+// Address trace for cache simulators. Every instruction fetch, load and
+// store is written in Dinero IV "din" format, one "label address" line per
+// access with label 0 for a read, 1 for a write and 2 for a fetch and the
+// address in hex. The binary variant writes 5 bytes per access, the label
+// and the address as a little-endian uint32.
+//
+// The simulator appends accesses to a chunk of a large buffer and hands
+// full chunks to a writer thread, which formats and writes them; it only
+// waits when the writer is a whole buffer behind. The reference interpreter
+// produces the accesses, so a traced run uses ENGINE_SWITCH.
+
+#define DIN_READ 0
+#define DIN_WRITE 1
+#define DIN_FETCH 2
+
+#define DIN_MAX_RANGES 16
+
+enum din_format {
+    DIN_TEXT,
+    DIN_BINARY
+};
+
+struct din_writer;
+
+struct dintrace {
+    uint64_t *pos, *end;    // free part of the chunk being filled
+    int on;                 // inside a sampling window
+    long sample_on;         // record sample_on of every sample_period
+    long sample_period;     // instructions, 0 to record all of them
+    int num_ranges;         // only accesses in one of the ranges, all if 0
+    uint32_t range_start[DIN_MAX_RANGES];
+    uint32_t range_end[DIN_MAX_RANGES];
+    struct din_writer *writer;
+};
+
+// Open the output (a file, or a named pipe read by the cache simulator) and
+// start the writer. Set the sampling and ranges in the result before the run.
+struct dintrace *dintrace_open(const char *path, enum din_format format);
+
+// hand the filled chunk to the writer, called when it is full
+void dintrace_flush(struct dintrace *d);
+
+// write what is left, stop the writer and close the output. Returns 0 if
+// everything was written.
+int dintrace_close(struct dintrace *d);
+
+// called before every instruction with the count including it
+static inline void dintrace_insn(struct dintrace *d, long insns){
+    if (d->sample_period)
+        d->on = (insns - 1) % d->sample_period < d->sample_on;
+}
+
+static inline void dintrace_access(struct dintrace *d, int label, uint32_t addr){
+    if (!d->on)
+        return;
+    if (d->num_ranges) {
+        int i = 0;
+        while (i < d->num_ranges && addr - d->range_start[i] >= d->range_end[i] - d->range_start[i])
+            i++;
+        if (i == d->num_ranges)
+            return;
+    }
+    *d->pos++ = (uint64_t)label << 32 | addr;
+    if (d->pos == d->end)
+        dintrace_flush(d);
+}
+
+#endif
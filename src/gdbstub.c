@@ -0,0 +1,364 @@
+#include "gdbstub.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Only the packets gdb needs for a bare-metal rv32 target are handled, the
+// rest get the empty reply that tells gdb they are not supported. The target
+// has a single thread and no target description, so gdb takes the
+// architecture from the ELF file. Interrupting a continue (^C) is not
+// supported, the engines do not poll the connection.
+
+#define PACKET_MAX 4096
+#define MAX_BREAKPOINTS 64
+
+struct gdb {
+    int fd;
+    struct memory *mem;
+    struct sim_session *session;
+    uint32_t breakpoints[MAX_BREAKPOINTS];
+    int num_breakpoints;
+    // the lists handed to the session, which keeps the pointer rather than
+    // a copy. A new list goes to the other buffer, so the previous one is
+    // still intact while the session invalidates its breakpoints.
+    uint32_t lists[2][MAX_BREAKPOINTS];
+    int current;
+    int attached;
+    int detached;   // the program runs on to its end
+};
+
+static int listen_on(const char *address)
+{
+    int fd;
+    if (strchr(address, '/')) {
+        struct sockaddr_un sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", address);
+        unlink(address);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+            return -1;
+    } else {
+        struct sockaddr_in sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sin_family = AF_INET;
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        sa.sin_port = htons(atoi(address[0] == ':' ? address + 1 : address));
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        if (fd < 0)
+            return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+            return -1;
+    }
+    if (listen(fd, 1) < 0)
+        return -1;
+    fprintf(stderr, "Waiting for gdb on %s\n", address);
+    int conn = accept(fd, NULL, NULL);
+    close(fd);
+    if (conn >= 0 && !strchr(address, '/')) {
+        int one = 1;
+        setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return conn;
+}
+
+// Packet layer --------------------------------------------------------------
+
+static int get_char(struct gdb *g)
+{
+    unsigned char c;
+    return read(g->fd, &c, 1) == 1 ? c : -1;
+}
+
+static int hex_digit(int c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Read the next packet into buf, acknowledging it. Returns its length, or -1
+// when the connection is gone.
+static int get_packet(struct gdb *g, char *buf)
+{
+    for (;;) {
+        int c;
+        do {
+            c = get_char(g);
+            if (c < 0)
+                return -1;
+        } while (c != '$');
+        int len = 0;
+        unsigned sum = 0;
+        while ((c = get_char(g)) >= 0 && c != '#') {
+            if (len < PACKET_MAX - 1)
+                buf[len++] = (char)c;
+            sum += (unsigned)c;
+        }
+        int hi = hex_digit(get_char(g)), lo = hex_digit(get_char(g));
+        if (c < 0 || hi < 0 || lo < 0)
+            return -1;
+        buf[len] = 0;
+        if ((unsigned)(hi * 16 + lo) == (sum & 0xff)) {
+            if (write(g->fd, "+", 1) != 1)
+                return -1;
+            return len;
+        }
+        if (write(g->fd, "-", 1) != 1)
+            return -1;
+    }
+}
+
+static void put_packet(struct gdb *g, const char *data)
+{
+    char buf[PACKET_MAX + 8];
+    unsigned sum = 0;
+    int len = strlen(data);
+    for (int i = 0; i < len; i++)
+        sum += (unsigned char)data[i];
+    int n = snprintf(buf, sizeof(buf), "$%s#%02x", data, sum & 0xff);
+    for (int tries = 0; tries < 3; tries++) {
+        if (write(g->fd, buf, n) != n)
+            return;
+        int c = get_char(g);
+        if (c != '-')
+            return;
+    }
+}
+
+// Registers are sent as 8 hex digits in target (little-endian) byte order
+static void put_hex32(char *p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        sprintf(p + 2 * i, "%02x", (v >> (8 * i)) & 0xff);
+}
+
+static uint32_t get_hex32(const char *p)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++)
+        v |= (uint32_t)(hex_digit(p[2 * i]) * 16 + hex_digit(p[2 * i + 1])) << (8 * i);
+    return v;
+}
+
+// Commands ------------------------------------------------------------------
+
+static void reply_stop(struct gdb *g, enum sim_stop stop)
+{
+    char buf[64];
+    switch (stop) {
+    case SIM_STOP_EXIT:
+        put_packet(g, "W00");
+        g->attached = 0;
+        break;
+    case SIM_STOP_WATCHPOINT:
+        snprintf(buf, sizeof(buf), "T05watch:%x;", sim_session_watch_addr(g->session));
+        put_packet(g, buf);
+        break;
+    case SIM_STOP_TRAP:
+        put_packet(g, "S07");   // SIGBUS
+        break;
+    default:
+        put_packet(g, "S05");   // SIGTRAP
+    }
+}
+
+static int set_breakpoint(struct gdb *g, uint32_t addr, int insert)
+{
+    int i = 0;
+    while (i < g->num_breakpoints && g->breakpoints[i] != addr)
+        i++;
+    if (insert && i == g->num_breakpoints) {
+        if (g->num_breakpoints == MAX_BREAKPOINTS)
+            return -1;
+        g->breakpoints[g->num_breakpoints++] = addr;
+    } else if (!insert && i < g->num_breakpoints) {
+        g->breakpoints[i] = g->breakpoints[--g->num_breakpoints];
+    }
+    g->current ^= 1;
+    memcpy(g->lists[g->current], g->breakpoints, g->num_breakpoints * sizeof(uint32_t));
+    sim_session_set_breakpoints(g->session, g->lists[g->current], g->num_breakpoints);
+    return 0;
+}
+
+// Z/z packets: type,addr,kind
+static void breakpoint_packet(struct gdb *g, const char *p, int insert)
+{
+    int type = p[0] - '0';
+    unsigned long addr, kind;
+    if (sscanf(p + 1, ",%lx,%lx", &addr, &kind) != 2) {
+        put_packet(g, "E01");
+        return;
+    }
+    if (type == 0 || type == 1) {
+        if (addr & 3)           // no instruction there
+            put_packet(g, "E01");
+        else
+            put_packet(g, set_breakpoint(g, (uint32_t)addr, insert) ? "E02" : "OK");
+    } else if (type == 2) {
+        if (insert)
+            memory_watch(g->mem, (uint32_t)addr, (uint32_t)kind);
+        else
+            memory_unwatch(g->mem, (uint32_t)addr, (uint32_t)kind);
+        put_packet(g, "OK");
+    } else {
+        put_packet(g, "");      // read and access watchpoints
+    }
+}
+
+static void handle_packet(struct gdb *g, char *p)
+{
+    char buf[PACKET_MAX];
+    struct cpu_state *cpu = sim_session_cpu(g->session);
+    unsigned long addr, len;
+    switch (p[0]) {
+    case '?':
+        put_packet(g, "S05");
+        break;
+    case 'g':
+        for (int r = 0; r < 32; r++)
+            put_hex32(buf + 8 * r, cpu->R[r]);
+        put_hex32(buf + 8 * 32, cpu->pc);
+        put_packet(g, buf);
+        break;
+    case 'G':
+        if (strlen(p + 1) < 8 * 33) {
+            put_packet(g, "E01");
+            break;
+        }
+        for (int r = 1; r < 32; r++)
+            cpu->R[r] = get_hex32(p + 1 + 8 * r);
+        cpu->pc = get_hex32(p + 1 + 8 * 32);
+        put_packet(g, "OK");
+        break;
+    case 'p': {
+        unsigned long r = strtoul(p + 1, NULL, 16);
+        if (r > 32) {
+            put_packet(g, "E01");
+            break;
+        }
+        put_hex32(buf, r == 32 ? cpu->pc : cpu->R[r]);
+        put_packet(g, buf);
+        break;
+    }
+    case 'P': {
+        char *eq = strchr(p, '=');
+        unsigned long r = strtoul(p + 1, NULL, 16);
+        if (!eq || r > 32 || strlen(eq + 1) < 8) {
+            put_packet(g, "E01");
+            break;
+        }
+        if (r == 32)
+            cpu->pc = get_hex32(eq + 1);
+        else if (r != 0)
+            cpu->R[r] = get_hex32(eq + 1);
+        put_packet(g, "OK");
+        break;
+    }
+    case 'm':
+        if (sscanf(p + 1, "%lx,%lx", &addr, &len) != 2 || len > (PACKET_MAX - 1) / 2) {
+            put_packet(g, "E01");
+            break;
+        }
+        for (unsigned long i = 0; i < len; i++)
+            sprintf(buf + 2 * i, "%02x", memory_rd_b(g->mem, (int)(addr + i)) & 0xff);
+        buf[2 * len] = 0;
+        put_packet(g, buf);
+        break;
+    case 'M': {
+        char *data = strchr(p, ':');
+        if (!data || sscanf(p + 1, "%lx,%lx", &addr, &len) != 2 || strlen(data + 1) < 2 * len) {
+            put_packet(g, "E01");
+            break;
+        }
+        // stores go through the normal path, so decoded code is invalidated
+        for (unsigned long i = 0; i < len; i++)
+            memory_wr_b(g->mem, (int)(addr + i),
+                        hex_digit(data[1 + 2 * i]) * 16 + hex_digit(data[2 + 2 * i]));
+        put_packet(g, "OK");
+        break;
+    }
+    case 'c':
+    case 's':
+        if (p[1] && sscanf(p + 1, "%lx", &addr) == 1)
+            cpu->pc = (uint32_t)addr;
+        reply_stop(g, p[0] == 'c' ? sim_session_continue(g->session) : sim_session_step(g->session));
+        break;
+    case 'Z':
+    case 'z':
+        breakpoint_packet(g, p + 1, p[0] == 'Z');
+        break;
+    case 'H':
+        put_packet(g, "OK");
+        break;
+    case 'T':
+        put_packet(g, "OK");
+        break;
+    case 'D':
+        put_packet(g, "OK");
+        g->attached = 0;
+        g->detached = 1;
+        break;
+    case 'k':
+        g->attached = 0;
+        break;
+    case 'q':
+        if (!strncmp(p, "qSupported", 10)) {
+            snprintf(buf, sizeof(buf), "PacketSize=%x", PACKET_MAX - 8);
+            put_packet(g, buf);
+        } else if (!strcmp(p, "qAttached")) {
+            put_packet(g, "1");
+        } else if (!strcmp(p, "qC")) {
+            put_packet(g, "QC1");
+        } else if (!strcmp(p, "qfThreadInfo")) {
+            put_packet(g, "m1");
+        } else if (!strcmp(p, "qsThreadInfo")) {
+            put_packet(g, "l");
+        } else {
+            put_packet(g, "");
+        }
+        break;
+    default:
+        put_packet(g, "");
+    }
+}
+
+struct Stat gdb_serve(struct memory *mem, int start_addr, struct symbols *symbols,
+                      const struct sim_options *opts, const char *address)
+{
+    struct gdb g;
+    memset(&g, 0, sizeof(g));
+    g.mem = mem;
+    g.fd = listen_on(address);
+    if (g.fd < 0) {
+        perror(address);
+        exit(-1);
+    }
+    g.session = sim_session_create(mem, start_addr, NULL, symbols, opts);
+    g.attached = 1;
+    char packet[PACKET_MAX];
+    while (g.attached) {
+        if (get_packet(&g, packet) < 0)
+            break;
+        handle_packet(&g, packet);
+    }
+    close(g.fd);
+    if (g.detached) {
+        sim_session_set_breakpoints(g.session, NULL, 0);
+        enum sim_stop stop;
+        do
+            stop = sim_session_continue(g.session);
+        while (stop == SIM_STOP_WATCHPOINT);
+    }
+    return sim_session_finish(g.session);
+}
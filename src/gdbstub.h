@@ -0,0 +1,16 @@
+#ifndef __GDBSTUB_H__
+#define __GDBSTUB_H__
+
+#include "simulate.h"
+
+// GDB remote serial protocol server. Waits for one debugger connection on
+// address, which is a Unix socket path (anything containing a '/') or a TCP
+// port on localhost ("1234" or ":1234"), and runs the program under its
+// control until it ends or the debugger detaches or kills it. Continue runs
+// the engine selected in opts, so breakpoints (Z0/Z1) and write watchpoints
+// (Z2) cost nothing until they hit; single steps run on the reference
+// interpreter. Returns the statistics of the run.
+struct Stat gdb_serve(struct memory *mem, int start_addr, struct symbols *symbols,
+                      const struct sim_options *opts, const char *address);
+
+#endif
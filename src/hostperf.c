@@ -0,0 +1,122 @@
+#include "hostperf.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+static const char *counter_names[HP_NUM_COUNTERS] = {
+    "cycles", "instructions", "branch-misses", "cache-misses",
+    "dTLB-misses", "task-clock-ns", "page-faults"
+};
+
+static const char *phase_names[HP_NUM_PHASES] = {"load", "execute", "report"};
+
+static int fds[HP_NUM_COUNTERS];
+static uint64_t counts[HP_NUM_PHASES][HP_NUM_COUNTERS];
+static int open_errno;
+
+static int open_counter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;    // allowed with the default perf_event_paranoid
+    attr.exclude_hv = 1;
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0)
+        open_errno = errno;
+    return fd;
+}
+
+int hostperf_open(void)
+{
+    fds[HP_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fds[HP_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fds[HP_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fds[HP_CACHE_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fds[HP_DTLB_MISSES] = open_counter(PERF_TYPE_HW_CACHE,
+                                       PERF_COUNT_HW_CACHE_DTLB |
+                                       (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    fds[HP_TASK_CLOCK] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+    fds[HP_PAGE_FAULTS] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+    int available = 0;
+    for (int c = 0; c < HP_NUM_COUNTERS; c++)
+        available += fds[c] >= 0;
+    return available;
+}
+
+void hostperf_close(void)
+{
+    for (int c = 0; c < HP_NUM_COUNTERS; c++) {
+        if (fds[c] >= 0)
+            close(fds[c]);
+        fds[c] = -1;
+    }
+}
+
+void hostperf_begin(void)
+{
+    for (int c = 0; c < HP_NUM_COUNTERS; c++) {
+        if (fds[c] >= 0) {
+            ioctl(fds[c], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[c], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void hostperf_end(enum hostperf_phase phase)
+{
+    for (int c = 0; c < HP_NUM_COUNTERS; c++) {
+        if (fds[c] >= 0)
+            ioctl(fds[c], PERF_EVENT_IOC_DISABLE, 0);
+    }
+    for (int c = 0; c < HP_NUM_COUNTERS; c++) {
+        uint64_t value;
+        if (fds[c] >= 0 && read(fds[c], &value, sizeof(value)) == sizeof(value))
+            counts[phase][c] += value;
+    }
+}
+
+void hostperf_report(FILE *out, long guest_insns)
+{
+    fprintf(out, "\nHost performance counters (user mode):\n");
+    fprintf(out, "%-16s", "counter");
+    for (int p = 0; p < HP_NUM_PHASES; p++)
+        fprintf(out, " %16s", phase_names[p]);
+    fprintf(out, "\n");
+    for (int c = 0; c < HP_NUM_COUNTERS; c++) {
+        fprintf(out, "%-16s", counter_names[c]);
+        for (int p = 0; p < HP_NUM_PHASES; p++) {
+            if (fds[c] >= 0)
+                fprintf(out, " %16llu", (unsigned long long)counts[p][c]);
+            else
+                fprintf(out, " %16s", "n/a");
+        }
+        fprintf(out, "\n");
+    }
+    if (open_errno)
+        fprintf(out, "(some counters unavailable: %s)\n", strerror(open_errno));
+
+    if (guest_insns <= 0)
+        return;
+    const uint64_t *exec = counts[HP_PHASE_EXECUTE];
+    double n = (double)guest_insns;
+    if (fds[HP_CYCLES] >= 0)
+        fprintf(out, "Host cycles per guest instruction: %.2f\n", exec[HP_CYCLES] / n);
+    if (fds[HP_INSTRUCTIONS] >= 0)
+        fprintf(out, "Host instructions per guest instruction: %.2f\n", exec[HP_INSTRUCTIONS] / n);
+    if (fds[HP_BRANCH_MISSES] >= 0)
+        fprintf(out, "Host branch mispredicts per guest instruction: %.4f\n", exec[HP_BRANCH_MISSES] / n);
+    if (fds[HP_CACHE_MISSES] >= 0)
+        fprintf(out, "Host cache misses per guest instruction: %.4f\n", exec[HP_CACHE_MISSES] / n);
+    if (fds[HP_DTLB_MISSES] >= 0)
+        fprintf(out, "Host dTLB misses per guest instruction: %.4f\n", exec[HP_DTLB_MISSES] / n);
+    if (fds[HP_TASK_CLOCK] >= 0)
+        fprintf(out, "Host ns per guest instruction: %.2f\n", exec[HP_TASK_CLOCK] / n);
+}
@@ -0,0 +1,39 @@
+#ifndef __HOSTPERF_H__
+#define __HOSTPERF_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Host performance counters (perf_event_open) for the simulator process itself,
+// used by --host-perf to measure the load, execute and report phases.
+
+enum hostperf_counter {
+    HP_CYCLES,
+    HP_INSTRUCTIONS,
+    HP_BRANCH_MISSES,
+    HP_CACHE_MISSES,
+    HP_DTLB_MISSES,
+    HP_TASK_CLOCK,      // nanoseconds, software counter
+    HP_PAGE_FAULTS,     // software counter
+    HP_NUM_COUNTERS
+};
+
+enum hostperf_phase {
+    HP_PHASE_LOAD,
+    HP_PHASE_EXECUTE,
+    HP_PHASE_REPORT,
+    HP_NUM_PHASES
+};
+
+// open the counters, returns the number of counters available
+int hostperf_open(void);
+void hostperf_close(void);
+
+// count from begin to end and add the result to the given phase
+void hostperf_begin(void);
+void hostperf_end(enum hostperf_phase phase);
+
+// print per phase counts and per guest instruction ratios for the execute phase
+void hostperf_report(FILE *out, long guest_insns);
+
+#endif
@@ -0,0 +1,189 @@
+#include "imagecache.h"
+#include "elf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// An image file is the header and the page numbers, padded to IMAGE_ALIGN,
+// then the pages in that order, the symbol table and the string table.
+// Every part is checked against the file size before it is used, so a
+// truncated or foreign file is rebuilt rather than trusted.
+#define IMAGE_MAGIC 0x32474d4956435352ull   // "RSCVIMG2"
+#define IMAGE_ALIGN 4096
+
+struct image_header
+{
+    uint64_t magic;
+    uint64_t hash;          // of the ELF file
+    uint64_t elf_size;
+    struct program_info info;
+    uint32_t num_pages;
+    uint64_t pages_offset;
+    uint32_t num_symbols;
+    uint32_t strtab_size;
+    // followed by num_pages uint16_t page numbers
+};
+
+static uint64_t image_symbols_offset(const struct image_header *h)
+{
+    return h->pages_offset + (uint64_t)h->num_pages * MEMORY_PAGE_SIZE;
+}
+
+static uint64_t image_size(const struct image_header *h)
+{
+    return image_symbols_offset(h) + (uint64_t)h->num_symbols * sizeof(Elf32_Sym) + h->strtab_size;
+}
+
+// FNV-1a over the whole file
+static int hash_file(const char *file_name, uint64_t *hash, uint64_t *size)
+{
+    int fd = open(file_name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    const uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (off_t i = 0; i < st.st_size; i++)
+        h = (h ^ data[i]) * 0x100000001b3ull;
+    munmap((void *)data, st.st_size);
+    *hash = h;
+    *size = st.st_size;
+    return 0;
+}
+
+static int load_elf(const char *file_name, struct memory *mem, struct program_info *info,
+                    struct symbols **symbols, FILE *log_file)
+{
+    int status = read_elf(mem, info, file_name, log_file);
+    if (status)
+        return status;
+    *symbols = symbols_read_from_elf(file_name);
+    return *symbols ? 0 : -1;
+}
+
+static int map_image(const char *path, uint64_t hash, uint64_t elf_size, struct memory *mem,
+                     struct program_info *info, struct symbols **symbols)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct image_header)) {
+        close(fd);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    const struct image_header *h = (const struct image_header *)map;
+    if (h->magic != IMAGE_MAGIC || h->hash != hash || h->elf_size != elf_size
+        || h->num_pages > 0x10000
+        || h->pages_offset < sizeof(*h) + h->num_pages * sizeof(uint16_t)
+        || h->pages_offset % IMAGE_ALIGN || image_size(h) != (uint64_t)st.st_size) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    *info = h->info;
+    const uint8_t *symtab = map + image_symbols_offset(h);
+    *symbols = symbols_create(symtab, h->num_symbols,
+                              (const char *)symtab + h->num_symbols * sizeof(Elf32_Sym), h->strtab_size);
+    memory_map_image(mem, map, st.st_size, (const uint16_t *)(h + 1), h->num_pages,
+                     map + h->pages_offset);
+    return 0;
+}
+
+static int write_image(FILE *out, const struct image_header *h, struct memory *mem,
+                       const uint16_t *numbers, struct symbols *symbols)
+{
+    static const uint8_t zeros[IMAGE_ALIGN];
+    const void *symtab;
+    const char *strtab;
+    unsigned int strtab_size;
+    symbols_tables(symbols, &symtab, &strtab, &strtab_size);
+    size_t head = sizeof(*h) + h->num_pages * sizeof(uint16_t);
+    if (fwrite(h, sizeof(*h), 1, out) != 1
+        || fwrite(numbers, sizeof(uint16_t), h->num_pages, out) != h->num_pages
+        || fwrite(zeros, 1, h->pages_offset - head, out) != h->pages_offset - head)
+        return -1;
+    for (uint32_t i = 0; i < h->num_pages; i++)
+        if (fwrite(memory_page_data(mem, numbers[i]), MEMORY_PAGE_SIZE, 1, out) != 1)
+            return -1;
+    if (fwrite(symtab, sizeof(Elf32_Sym), h->num_symbols, out) != h->num_symbols
+        || fwrite(strtab, 1, strtab_size, out) != strtab_size)
+        return -1;
+    return 0;
+}
+
+// Load the ELF file into an empty memory and write its image to path. The
+// image is written under a temporary name and renamed, so concurrent runs
+// never see half a file. Returns what loading the ELF file returned, and
+// sets written if the image could be written.
+static int build_image(const char *path, const char *file_name, uint64_t hash, uint64_t elf_size,
+                       FILE *log_file, int *written)
+{
+    struct memory *mem = memory_create();
+    struct program_info info;
+    struct symbols *symbols = NULL;
+    int status = load_elf(file_name, mem, &info, &symbols, log_file);
+    if (status) {
+        memory_delete(mem);
+        return status;
+    }
+    const uint16_t *numbers;
+    struct image_header h;
+    const void *symtab;
+    const char *strtab;
+    memset(&h, 0, sizeof(h));
+    h.magic = IMAGE_MAGIC;
+    h.hash = hash;
+    h.elf_size = elf_size;
+    h.info = info;
+    h.num_pages = memory_live_pages(mem, &numbers);
+    h.pages_offset = (sizeof(h) + h.num_pages * sizeof(uint16_t) + IMAGE_ALIGN - 1) & ~(uint64_t)(IMAGE_ALIGN - 1);
+    h.num_symbols = symbols_tables(symbols, &symtab, &strtab, &h.strtab_size);
+
+    char tmp[4096 + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+    FILE *out = fopen(tmp, "wb");
+    *written = 0;
+    if (out) {
+        int failed = write_image(out, &h, mem, numbers, symbols);
+        if (fclose(out) || failed || rename(tmp, path))
+            unlink(tmp);
+        else
+            *written = 1;
+    }
+    symbols_delete(symbols);
+    memory_delete(mem);
+    return 0;
+}
+
+int imagecache_load(const char *dir, const char *file_name, struct memory *mem,
+                    struct program_info *info, struct symbols **symbols, FILE *log_file)
+{
+    uint64_t hash, elf_size;
+    if (hash_file(file_name, &hash, &elf_size))
+        return load_elf(file_name, mem, info, symbols, log_file);
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%016llx.img", dir, (unsigned long long)hash);
+    if (map_image(path, hash, elf_size, mem, info, symbols) == 0)
+        return 0;
+    int written;
+    int status = build_image(path, file_name, hash, elf_size, log_file, &written);
+    if (status)
+        return status;
+    if (written && map_image(path, hash, elf_size, mem, info, symbols) == 0)
+        return 0;
+    fprintf(stderr, "Could not use the image cache in %s, loading %s directly\n", dir, file_name);
+    return load_elf(file_name, mem, info, symbols, log_file);
+}
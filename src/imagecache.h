@@ -0,0 +1,20 @@
+#ifndef __IMAGECACHE_H__
+#define __IMAGECACHE_H__
+
+#include "memory.h"
+#include "read_elf.h"
+
+#include <stdio.h>
+
+// Cache of loaded programs. The first run of an ELF file loads it with
+// read_elf() and symbols_read_from_elf() into an empty memory and writes the
+// resulting pages, program info and symbol table to one file in dir, named
+// by a hash of the ELF file's contents. Later runs of the same contents map
+// that file and use its pages directly as guest memory (copy-on-write), so
+// only the pages the program touches are ever read. If the cache cannot be
+// read or written, the ELF file is loaded directly. Returns what read_elf()
+// would, or -1 if there is no symbol table.
+int imagecache_load(const char *dir, const char *file_name, struct memory *mem,
+                    struct program_info *info, struct symbols **symbols, FILE *log_file);
+
+#endif
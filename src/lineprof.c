@@ -0,0 +1,105 @@
+#include "lineprof.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct lineprof *lineprof_create(uint32_t start, uint32_t end)
+{
+    struct lineprof *p = calloc(1, sizeof(struct lineprof));
+    p->start = start & ~3u;
+    p->end = end > p->start ? end : p->start;
+    size_t words = (p->end - p->start + 3) / 4;
+    p->insns = calloc(words + 1, sizeof(long));
+    p->branches = calloc(words + 1, sizeof(long));
+    p->mispredicts = calloc(words + 1, sizeof(long));
+    return p;
+}
+
+// A row of the written profile: a source line, or a single instruction
+// (file NULL) if it has no line
+struct prof_row {
+    const char *file;
+    uint32_t line;      // or the address
+    long insns, branches, mispredicts;
+};
+
+static int compare_location(const void *a, const void *b)
+{
+    const struct prof_row *x = a, *y = b;
+    if (x->file != y->file)
+        return x->file == NULL ? 1 : y->file == NULL ? -1 : strcmp(x->file, y->file);
+    return x->line < y->line ? -1 : x->line > y->line;
+}
+
+static int compare_insns(const void *a, const void *b)
+{
+    const struct prof_row *x = a, *y = b;
+    if (x->insns != y->insns)
+        return x->insns > y->insns ? -1 : 1;
+    return compare_location(a, b);
+}
+
+void lineprof_write(struct lineprof *p, const struct line_table *lines, struct symbols *symbols, FILE *f)
+{
+    size_t words = (p->end - p->start) / 4;
+    struct prof_row *rows = malloc((words + 1) * sizeof(struct prof_row));
+    size_t num = 0;
+    for (size_t i = 0; i < words; i++) {
+        if (!p->insns[i])
+            continue;
+        uint32_t pc = p->start + 4 * i;
+        struct prof_row *r = &rows[num++];
+        r->file = NULL;
+        r->line = lines ? line_table_lookup(lines, pc, &r->file) : 0;
+        if (!r->line) {
+            r->file = NULL;
+            r->line = pc;
+        }
+        r->insns = p->insns[i];
+        r->branches = p->branches[i];
+        r->mispredicts = p->mispredicts[i];
+    }
+
+    // merge the instructions of each line
+    qsort(rows, num, sizeof(struct prof_row), compare_location);
+    size_t merged = 0;
+    for (size_t i = 0; i < num; i++) {
+        if (merged && rows[i].file && !compare_location(&rows[merged - 1], &rows[i])) {
+            rows[merged - 1].insns += rows[i].insns;
+            rows[merged - 1].branches += rows[i].branches;
+            rows[merged - 1].mispredicts += rows[i].mispredicts;
+        } else {
+            rows[merged++] = rows[i];
+        }
+    }
+    qsort(rows, merged, sizeof(struct prof_row), compare_insns);
+
+    if (!lines)
+        fprintf(f, "# no .debug_line in the ELF file, counts are per instruction\n");
+    fprintf(f, "%-40s %12s %10s %10s\n", "location", "insns", "branches", "mispredicts");
+    for (size_t i = 0; i < merged; i++) {
+        struct prof_row *r = &rows[i];
+        char location[256];
+        if (r->file) {
+            snprintf(location, sizeof(location), "%s:%u", r->file, r->line);
+        } else {
+            unsigned int offset;
+            const char *func = symbols_addr_to_func(symbols, r->line, &offset);
+            if (func)
+                snprintf(location, sizeof(location), "0x%08x <%s+0x%x>", r->line, func, offset);
+            else
+                snprintf(location, sizeof(location), "0x%08x", r->line);
+        }
+        fprintf(f, "%-40s %12ld %10ld %10ld\n", location, r->insns, r->branches, r->mispredicts);
+    }
+    if (p->other)
+        fprintf(f, "%-40s %12ld\n", "(outside the text)", p->other);
+    free(rows);
+}
+
+void lineprof_delete(struct lineprof *p)
+{
+    free(p->insns);
+    free(p->branches);
+    free(p->mispredicts);
+    free(p);
+}
@@ -0,0 +1,45 @@
+#ifndef __LINEPROF_H__
+#define __LINEPROF_H__
+
+#include "simulate.h"
+#include "debugline.h"
+#include <stdio.h>
+#include <stdint.h>
+
+// Execution profile (-p): how often every instruction of the text ran and,
+// for conditional branches, how often the largest gShare predictor
+// mispredicted them. Counted per instruction word by the reference
+// interpreter, so a profiled run uses ENGINE_SWITCH. Source lines are only
+// looked up when the profile is written.
+struct lineprof {
+    uint32_t start, end;    // the counted range
+    long *insns;            // per word of the range
+    long *branches;
+    long *mispredicts;
+    long other;             // instructions outside the range
+};
+
+struct lineprof *lineprof_create(uint32_t start, uint32_t end);
+
+static inline void lineprof_insn(struct lineprof *p, uint32_t pc){
+    if (pc - p->start < p->end - p->start)
+        p->insns[(pc - p->start) >> 2]++;
+    else
+        p->other++;
+}
+
+static inline void lineprof_branch(struct lineprof *p, uint32_t pc, int mispredicted){
+    if (pc - p->start < p->end - p->start) {
+        p->branches[(pc - p->start) >> 2]++;
+        p->mispredicts[(pc - p->start) >> 2] += mispredicted;
+    }
+}
+
+// Write the counts per source line ("radix.c:42") with lines, hottest first.
+// Instructions without a line, or all of them when lines is NULL (the ELF
+// file has no .debug_line), are listed by address and function.
+void lineprof_write(struct lineprof *p, const struct line_table *lines, struct symbols *symbols, FILE *f);
+
+void lineprof_delete(struct lineprof *p);
+
+#endif
@@ -2,11 +2,39 @@
 #include "read_elf.h"
 #include "disassemble.h"
 #include "simulate.h"
+#include "hostperf.h"
+#include "phaseprof.h"
+#include "statstream.h"
+#include "missprofile.h"
+#include "gdbstub.h"
+#include "imagecache.h"
+#include "callgraph.h"
+#include "lineprof.h"
+#include "debugline.h"
+#include "dintrace.h"
+#include "reuse.h"
+#include "pageheat.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+// Address given as a number or an ELF symbol
+static uint32_t parse_address(struct symbols *symbols, const char *spec)
+{
+  char *end;
+  unsigned long value = strtoul(spec, &end, 0);
+  if (end != spec && *end == 0)
+    return (uint32_t)value;
+  unsigned int sym_value;
+  if (symbols_sym_to_value(symbols, spec, &sym_value))
+  {
+    fprintf(stderr, "Unknown address or symbol '%s'\n", spec);
+    exit(-1);
+  }
+  return sym_value;
+}
+
 void terminate(const char *error)
 {
   printf("%s\n", error);
@@ -16,6 +44,34 @@ void terminate(const char *error)
   printf("      sim riscv-elf -d         // disassemble text segment of riscv-elf file to stdout\n");
   printf("      sim riscv-elf -l log     // simulate and log each instruction to file 'log'\n");
   printf("      sim riscv-elf -s log     // simulate and log only summary to file 'log'\n");
+  printf("      sim riscv-elf -p prof    // count instructions and mispredictions per source line (or instruction) to 'prof'\n");
+  printf("      sim riscv-elf --host-perf // report host performance counters per simulator phase\n");
+  printf("      sim riscv-elf --phase-prof // sample which part of the simulator is running (1000 Hz)\n");
+  printf("      sim riscv-elf --phase-prof-hz n // as --phase-prof, sampling n times per second (1 to 100000)\n");
+  printf("      sim riscv-elf --stats-every n file // write statistics deltas every n instructions to file ('-' = stderr)\n");
+  printf("      sim riscv-elf --miss-profile file // record mispredictions per interval to binary 'file'\n");
+  printf("      sim riscv-elf --miss-interval n   // interval for --miss-profile (default 1000000 instructions)\n");
+  printf("      sim riscv-elf --huge-pages // back guest memory with 2 MiB huge pages if available\n");
+  printf("      sim riscv-elf --engine name // execution engine: switch, predecode, fused or block (default)\n");
+  printf("      sim riscv-elf --misaligned policy // misaligned loads and stores: abort (default), emulate or trap\n");
+  printf("      sim riscv-elf --break addr|symbol // stop before the instruction and dump the registers (repeatable)\n");
+  printf("      sim riscv-elf --watch addr|symbol[:size] // stop after a store to the range (default 4 bytes, repeatable)\n");
+  printf("      sim riscv-elf --on-break dump|trace // at a break or watch: stop, or start the -l log there and go on\n");
+  printf("      sim riscv-elf --gdb port|socket-path // run under gdb ('target remote :port') on localhost or a Unix socket\n");
+  printf("      sim riscv-elf --din-trace file // write fetch, load and store addresses in Dinero IV din format (runs the reference engine)\n");
+  printf("      sim riscv-elf --din-format text|binary // din text (default) or 5 byte records: label, little-endian address\n");
+  printf("      sim riscv-elf --din-sample on:period // trace only the first 'on' of every 'period' instructions\n");
+  printf("      sim riscv-elf --din-range start:end // trace only addresses in [start, end), repeatable\n");
+  printf("      sim riscv-elf --reuse-distance file // write the LRU miss ratio curve of loads and stores as CSV (runs the reference engine)\n");
+  printf("      sim riscv-elf --reuse-line bytes // cache line size of the reuse distance analysis, default 64\n");
+  printf("      sim riscv-elf --page-heat file // write the working set over time and the hottest 4 KiB pages (runs the reference engine)\n");
+  printf("      sim riscv-elf --page-interval insns // instructions per working set interval, default 1000000\n");
+  printf("      sim riscv-elf --page-sample period // count the accesses of only every period'th instruction\n");
+  printf("      sim riscv-elf --callgraph file // folded call stacks for flamegraph.pl (runs the reference engine)\n");
+  printf("      sim riscv-elf --callgraph-metric insns|mispredicts|host-ns // value of the folded stacks (default insns)\n");
+  printf("      sim riscv-elf --callgraph-report file // every call path with inclusive and exclusive counts\n");
+  printf("      sim riscv-elf --predecode-text // decode all of the text before the run starts\n");
+  printf("      sim riscv-elf --image-cache dir // keep the loaded program in dir and map it on later runs\n");
   printf("    prog-args: arguments to the simulated program\n");
   printf("               these arguments are provided through argv. Puts '--' in argv[0]\n");
   printf("      sim riscv-elf -- gylletank   // run riscv-elf with 'gylletank' in argv[1]\n");
@@ -58,61 +114,431 @@ void disassemble_to_stdout(struct memory* mem, struct program_info* prog_info, s
 {
   const int buf_size = 100;
   char disassembly[buf_size];
-  for (unsigned int addr = prog_info->text_start; addr < prog_info->text_end; addr += 4) {
-    unsigned int instruction = memory_rd_w(mem, addr);
-    disassemble(addr, instruction, disassembly, buf_size, symbols);
-    printf("%8x : %08X       %s\n", addr, instruction, disassembly);
+  for (int i = 0; i < prog_info->num_text; i++) {
+    for (unsigned int addr = prog_info->text[i].start; addr < prog_info->text[i].end; addr += 4) {
+      unsigned int instruction = memory_rd_w(mem, addr);
+      disassemble(addr, instruction, disassembly, buf_size, symbols);
+      printf("%8x : %08X       %s\n", addr, instruction, disassembly);
+    }
   }
 }
 
 int main(int argc, char *argv[])
 {
+  // has to be known before the first guest page is allocated
+  for (int i = 2; i < argc && strcmp(argv[i], "--"); i++)
+  {
+    if (!strcmp(argv[i], "--huge-pages"))
+      memory_set_huge_pages(1);
+  }
   struct memory *mem = memory_create();
   argc = pass_args_to_program(mem, argc, argv);
-  if (argc == 2 || argc == 3 || argc == 4)
+  if (argc >= 2)
   {
     FILE *log_file = NULL;
     FILE *prof_file = NULL;
-    if (argc == 4 && !strcmp(argv[2], "-l"))
+    const char *summary_name = NULL;
+    int disassemble_only = 0;
+    int host_perf = 0;
+    int huge_pages = 0;
+    int phase_prof_hz = 0;
+    const char *miss_profile_name = NULL;
+    // --break and --watch arguments, resolved once the symbols are read
+    const char **break_specs = calloc(argc, sizeof(char *));
+    const char **watch_specs = calloc(argc, sizeof(char *));
+    int num_breaks = 0, num_watches = 0;
+    const char *gdb_address = NULL;
+    const char *image_cache_dir = NULL;
+    int predecode_text = 0;
+    const char *callgraph_name = NULL;
+    const char *callgraph_report = NULL;
+    enum callgraph_metric callgraph_metric = CALLGRAPH_INSNS;
+    const char *din_name = NULL;
+    enum din_format din_format = DIN_TEXT;
+    long din_sample_on = 0, din_sample_period = 0;
+    uint32_t din_range_start[DIN_MAX_RANGES], din_range_end[DIN_MAX_RANGES];
+    int num_din_ranges = 0;
+    const char *reuse_name = NULL;
+    int reuse_line = 64;
+    const char *page_heat_name = NULL;
+    long page_interval = 1000000, page_sample = 0;
+    struct sim_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.engine = ENGINE_BLOCK;
+    opts.miss_interval = 1000000;
+    for (int i = 2; i < argc; i++)
     {
-      log_file = fopen(argv[3], "w");
-      if (log_file == NULL)
+      if (!strcmp(argv[i], "-d"))
+        disassemble_only = 1;
+      else if (!strcmp(argv[i], "-l") && i + 1 < argc)
       {
-        terminate("Could not open logfile, terminating.");
+        log_file = fopen(argv[++i], "w");
+        if (log_file == NULL)
+        {
+          terminate("Could not open logfile, terminating.");
+        }
       }
-    }
-    if (argc == 4 && !strcmp(argv[2], "-p"))
-    {
-      prof_file = fopen(argv[3], "w");
-      if (prof_file == NULL)
+      else if (!strcmp(argv[i], "-p") && i + 1 < argc)
+      {
+        prof_file = fopen(argv[++i], "w");
+        if (prof_file == NULL)
+        {
+          terminate("Could not open file for exec profile, terminating.");
+        }
+      }
+      else if (!strcmp(argv[i], "-s") && i + 1 < argc)
+        summary_name = argv[++i];
+      else if (!strcmp(argv[i], "--host-perf"))
+        host_perf = 1;
+      else if (!strcmp(argv[i], "--huge-pages"))
+        huge_pages = 1; // already applied before the memory was created
+      else if (!strcmp(argv[i], "--phase-prof"))
+        phase_prof_hz = 1000;
+      else if (!strcmp(argv[i], "--phase-prof-hz") && i + 1 < argc)
+      {
+        char *end;
+        const char *rate = argv[++i];
+        long hz = strtol(rate, &end, 10);
+        if (end == rate || *end || hz <= 0 || hz > 100000)
+        {
+          terminate("Bad phase profiler rate, terminating.");
+        }
+        phase_prof_hz = (int)hz;
+      }
+      else if (!strcmp(argv[i], "--stats-every") && i + 2 < argc)
+      {
+        opts.stream_interval = atol(argv[++i]);
+        opts.stream = statstream_open(argv[++i]);
+        if (opts.stream_interval <= 0 || opts.stream == NULL)
+        {
+          terminate("Could not open statistics stream, terminating.");
+        }
+      }
+      else if (!strcmp(argv[i], "--miss-profile") && i + 1 < argc)
+        miss_profile_name = argv[++i];
+      else if (!strcmp(argv[i], "--miss-interval") && i + 1 < argc)
+      {
+        opts.miss_interval = atol(argv[++i]);
+        if (opts.miss_interval <= 0)
+        {
+          terminate("Bad misprediction profile interval");
+        }
+      }
+      else if (!strcmp(argv[i], "--engine") && i + 1 < argc)
+      {
+        const char *name = argv[++i];
+        int e = 0;
+        while (e < NUM_ENGINES && strcmp(sim_engine_names[e], name))
+          e++;
+        if (e == NUM_ENGINES)
+        {
+          terminate("Unknown engine");
+        }
+        opts.engine = e;
+      }
+      else if (!strcmp(argv[i], "--misaligned") && i + 1 < argc)
+      {
+        const char *policy = argv[++i];
+        if (!strcmp(policy, "abort"))
+          memory_set_misalign_policy(mem, MISALIGN_ABORT);
+        else if (!strcmp(policy, "emulate"))
+          memory_set_misalign_policy(mem, MISALIGN_EMULATE);
+        else if (!strcmp(policy, "trap"))
+          memory_set_misalign_policy(mem, MISALIGN_TRAP);
+        else
+        {
+          terminate("Unknown misalignment policy");
+        }
+      }
+      else if (!strcmp(argv[i], "--break") && i + 1 < argc)
+        break_specs[num_breaks++] = argv[++i];
+      else if (!strcmp(argv[i], "--watch") && i + 1 < argc)
+        watch_specs[num_watches++] = argv[++i];
+      else if (!strcmp(argv[i], "--gdb") && i + 1 < argc)
+        gdb_address = argv[++i];
+      else if (!strcmp(argv[i], "--image-cache") && i + 1 < argc)
+        image_cache_dir = argv[++i];
+      else if (!strcmp(argv[i], "--predecode-text"))
+        predecode_text = 1;
+      else if (!strcmp(argv[i], "--din-trace") && i + 1 < argc)
+        din_name = argv[++i];
+      else if (!strcmp(argv[i], "--din-format") && i + 1 < argc)
       {
-        terminate("Could not open file for exec profile, terminating.");
+        const char *format = argv[++i];
+        if (!strcmp(format, "text"))
+          din_format = DIN_TEXT;
+        else if (!strcmp(format, "binary"))
+          din_format = DIN_BINARY;
+        else
+        {
+          terminate("Unknown address trace format");
+        }
+      }
+      else if (!strcmp(argv[i], "--din-sample") && i + 1 < argc)
+      {
+        if (sscanf(argv[++i], "%ld:%ld", &din_sample_on, &din_sample_period) != 2
+            || din_sample_on <= 0 || din_sample_period < din_sample_on)
+        {
+          terminate("Bad address trace sampling, use on:period");
+        }
+      }
+      else if (!strcmp(argv[i], "--din-range") && i + 1 < argc)
+      {
+        long start, end;
+        if (num_din_ranges == DIN_MAX_RANGES
+            || sscanf(argv[++i], "%li:%li", &start, &end) != 2 || end <= start)
+        {
+          terminate("Bad address trace range, use start:end");
+        }
+        din_range_start[num_din_ranges] = start;
+        din_range_end[num_din_ranges++] = end;
+      }
+      else if (!strcmp(argv[i], "--reuse-distance") && i + 1 < argc)
+        reuse_name = argv[++i];
+      else if (!strcmp(argv[i], "--reuse-line") && i + 1 < argc)
+      {
+        reuse_line = atoi(argv[++i]);
+        if (reuse_line < 4 || (reuse_line & (reuse_line - 1)))
+        {
+          terminate("Reuse distance line size must be a power of two of at least 4");
+        }
+      }
+      else if (!strcmp(argv[i], "--page-heat") && i + 1 < argc)
+        page_heat_name = argv[++i];
+      else if (!strcmp(argv[i], "--page-interval") && i + 1 < argc)
+      {
+        page_interval = atol(argv[++i]);
+        if (page_interval <= 0)
+        {
+          terminate("Working set interval must be positive");
+        }
+      }
+      else if (!strcmp(argv[i], "--page-sample") && i + 1 < argc)
+      {
+        page_sample = atol(argv[++i]);
+        if (page_sample <= 0)
+        {
+          terminate("Page heat sample period must be positive");
+        }
       }
+      else if (!strcmp(argv[i], "--callgraph") && i + 1 < argc)
+        callgraph_name = argv[++i];
+      else if (!strcmp(argv[i], "--callgraph-report") && i + 1 < argc)
+        callgraph_report = argv[++i];
+      else if (!strcmp(argv[i], "--callgraph-metric") && i + 1 < argc)
+      {
+        const char *name = argv[++i];
+        int m = 0;
+        while (m < NUM_CALLGRAPH_METRICS && strcmp(callgraph_metric_names[m], name))
+          m++;
+        if (m == NUM_CALLGRAPH_METRICS)
+        {
+          terminate("Unknown call-graph metric");
+        }
+        callgraph_metric = m;
+      }
+      else if (!strcmp(argv[i], "--on-break") && i + 1 < argc)
+      {
+        const char *action = argv[++i];
+        if (!strcmp(action, "dump"))
+          opts.on_break = BREAK_DUMP;
+        else if (!strcmp(action, "trace"))
+          opts.on_break = BREAK_TRACE;
+        else
+        {
+          terminate("Unknown break action");
+        }
+      }
+      else
+        terminate("Unknown option");
+    }
+    if (host_perf)
+    {
+      if (hostperf_open() == 0)
+        fprintf(stderr, "No host performance counters available\n");
+      hostperf_begin();
+    }
+    if (phase_prof_hz)
+    {
+      if (phaseprof_start(phase_prof_hz))
+        terminate("Could not start the phase profiler, terminating.");
     }
     struct program_info prog_info;
-    int status = read_elf(mem, &prog_info, argv[1], log_file);
-    if (status) exit(status);
-    // The use of symbols provide for a nicer disassembly, but their us in A4 is optional,
-    // so feel free to remove/ignore setup and use of symbols.
-    struct symbols* symbols = symbols_read_from_elf(argv[1]);
-    if (symbols == NULL) {
-      exit(-1);
-    }
-    if (argc == 3 && !strcmp(argv[2], "-d")) {
+    struct symbols* symbols = NULL;
+    // errors in the ELF file go to the log, or to stderr without one
+    FILE *elf_log = log_file ? log_file : stderr;
+    if (image_cache_dir)
+    {
+      int status = imagecache_load(image_cache_dir, argv[1], mem, &prog_info, &symbols, elf_log);
+      if (status) exit(status);
+    }
+    else
+    {
+      int status = read_elf(mem, &prog_info, argv[1], elf_log);
+      if (status) exit(status);
+      // The use of symbols provide for a nicer disassembly, but their us in A4 is optional,
+      // so feel free to remove/ignore setup and use of symbols.
+      symbols = symbols_read_from_elf(argv[1]);
+      if (symbols == NULL) {
+        exit(-1);
+      }
+    }
+    if (disassemble_only) {
       // disassemble text segment to stdout
       disassemble_to_stdout(mem, &prog_info, symbols);
       exit(0);
     }
+    if (miss_profile_name)
+    {
+      opts.miss_profile = missprofile_create(opts.miss_interval);
+    }
+    if (callgraph_name || callgraph_report)
+    {
+      opts.callgraph = callgraph_create(prog_info.start);
+    }
+    if (din_name)
+    {
+      opts.din_trace = dintrace_open(din_name, din_format);
+      if (opts.din_trace == NULL)
+      {
+        terminate("Could not open address trace, terminating.");
+      }
+      opts.din_trace->sample_on = din_sample_on;
+      opts.din_trace->sample_period = din_sample_period;
+      opts.din_trace->num_ranges = num_din_ranges;
+      memcpy(opts.din_trace->range_start, din_range_start, sizeof(din_range_start));
+      memcpy(opts.din_trace->range_end, din_range_end, sizeof(din_range_end));
+    }
+    if (reuse_name)
+    {
+      opts.reuse = reuse_create(reuse_line);
+    }
+    if (page_heat_name)
+    {
+      opts.page_heat = pageheat_create(mem, page_interval, page_sample);
+    }
+    struct line_table *lines = NULL;
+    if (prof_file)
+    {
+      opts.lineprof = lineprof_create(prog_info.text_start, prog_info.text_end);
+      lines = line_table_read(argv[1]);
+    }
+    uint32_t *breakpoints = calloc(num_breaks + 1, sizeof(uint32_t));
+    for (int i = 0; i < num_breaks; i++)
+    {
+      breakpoints[i] = parse_address(symbols, break_specs[i]);
+      if (breakpoints[i] & 3)
+      {
+        fprintf(stderr, "Breakpoint address 0x%x is not aligned to an instruction\n", breakpoints[i]);
+        exit(-1);
+      }
+    }
+    struct watchpoint *watchpoints = calloc(num_watches + 1, sizeof(struct watchpoint));
+    for (int i = 0; i < num_watches; i++)
+    {
+      char spec[256];
+      snprintf(spec, sizeof(spec), "%s", watch_specs[i]);
+      char *size = strchr(spec, ':');
+      watchpoints[i].size = 4;
+      if (size)
+      {
+        *size++ = 0;
+        watchpoints[i].size = atoi(size);
+        if (watchpoints[i].size == 0)
+          terminate("Bad watchpoint size");
+      }
+      watchpoints[i].addr = parse_address(symbols, spec);
+    }
+    opts.breakpoints = breakpoints;
+    opts.num_breakpoints = num_breaks;
+    opts.watchpoints = watchpoints;
+    opts.num_watchpoints = num_watches;
+    if (predecode_text)
+    {
+      opts.predecode = prog_info.text;
+      opts.num_predecode = prog_info.num_text;
+    }
+    if (host_perf)
+    {
+      hostperf_end(HP_PHASE_LOAD);
+      hostperf_begin();
+    }
     int start_addr = prog_info.start;
     clock_t before = clock();
-    struct Stat stats = simulate(mem, start_addr, log_file, symbols);
+    struct Stat stats;
+    if (gdb_address)
+      stats = gdb_serve(mem, start_addr, symbols, &opts, gdb_address);
+    else
+      stats = simulate(mem, start_addr, log_file, symbols, &opts);
     long int num_insns = stats.insns;
     clock_t after = clock();
+    // the profiles and traces below are written in the report phase
+    if (host_perf)
+    {
+      hostperf_end(HP_PHASE_EXECUTE);
+      hostperf_begin();
+    }
+    if (opts.stream)
+    {
+      statstream_close(opts.stream, &stats);
+    }
+    if (opts.miss_profile)
+    {
+      if (missprofile_write(opts.miss_profile, &stats, miss_profile_name))
+      {
+        fprintf(stderr, "Could not write misprediction profile to %s\n", miss_profile_name);
+      }
+      missprofile_delete(opts.miss_profile);
+    }
+    if (opts.callgraph)
+    {
+      const char *folded = callgraph_name ? callgraph_name : "/dev/null";
+      if (callgraph_write(opts.callgraph, &stats, symbols, callgraph_metric, folded, callgraph_report))
+      {
+        fprintf(stderr, "Could not write call-graph profile to %s\n", folded);
+      }
+      callgraph_delete(opts.callgraph);
+    }
+    if (opts.din_trace)
+    {
+      if (dintrace_close(opts.din_trace))
+      {
+        fprintf(stderr, "Could not write address trace to %s\n", din_name);
+      }
+    }
+    if (opts.reuse)
+    {
+      if (reuse_write(opts.reuse, reuse_name))
+      {
+        fprintf(stderr, "Could not write reuse distances to %s\n", reuse_name);
+      }
+      reuse_delete(opts.reuse);
+    }
+    if (opts.page_heat)
+    {
+      struct elf_section *sections = NULL;
+      int num_sections = read_elf_sections(argv[1], &sections);
+      if (pageheat_write(opts.page_heat, page_heat_name, PAGE_HEAT_TOP,
+                         sections, num_sections > 0 ? num_sections : 0, symbols))
+      {
+        fprintf(stderr, "Could not write page heat to %s\n", page_heat_name);
+      }
+      free(sections);
+      pageheat_delete(opts.page_heat);
+    }
+    if (opts.lineprof)
+    {
+      lineprof_write(opts.lineprof, lines, symbols, prof_file);
+      fclose(prof_file);
+      lineprof_delete(opts.lineprof);
+      if (lines)
+        line_table_delete(lines);
+    }
     int ticks = after - before;
     double mips = (1.0 * num_insns * CLOCKS_PER_SEC) / ticks / 1000000;
-    if (argc == 4 && !strcmp(argv[2], "-s"))
+    if (summary_name)
     {
-      log_file = fopen(argv[3], "w");
+      log_file = fopen(summary_name, "w");
       if (log_file == NULL)
       {
         terminate("Could not open logfile, terminating.");
@@ -147,6 +573,18 @@ int main(int argc, char *argv[])
         fprintf(log_file,
                 "BTFNT predictor: 0 branch predictions (no conditional branches executed)\n");
       }
+      if (stats.fused_insns > 0)
+        fprintf(log_file, "Fused: %ld instructions executed in superinstructions (%.2f%%)\n",
+                stats.fused_insns, stats.fused_insns * 100.0 / num_insns);
+      if (stats.traces > 0)
+        fprintf(log_file, "Traces: %ld formed, %ld runs, %.2f%% side exits, %.2f%% of instructions in traces\n",
+                stats.traces, stats.trace_runs,
+                stats.trace_runs ? stats.trace_exits * 100.0 / stats.trace_runs : 0.0,
+                stats.trace_insns * 100.0 / num_insns);
+      if (stats.misaligned > 0)
+        fprintf(log_file, "Misaligned: %ld accesses\n", stats.misaligned);
+      if (stats.code_writes > 0)
+        fprintf(log_file, "Self-modifying code: %ld stores invalidated decoded code\n", stats.code_writes);
 
       fclose(log_file);
     }
@@ -214,11 +652,41 @@ int main(int argc, char *argv[])
           printf("gShare %d: 0 branch predictions\n", size);
         }
       }
+      if (stats.fused_insns > 0)
+        printf("Fused: %ld instructions executed in superinstructions (%.2f%%)\n",
+               stats.fused_insns, stats.fused_insns * 100.0 / num_insns);
+      if (stats.traces > 0)
+        printf("Traces: %ld formed, %ld runs, %.2f%% side exits, %.2f%% of instructions in traces\n",
+               stats.traces, stats.trace_runs,
+               stats.trace_runs ? stats.trace_exits * 100.0 / stats.trace_runs : 0.0,
+               stats.trace_insns * 100.0 / num_insns);
+      if (stats.misaligned > 0)
+        printf("Misaligned: %ld accesses\n", stats.misaligned);
+      if (stats.code_writes > 0)
+        printf("Self-modifying code: %ld stores invalidated decoded code\n", stats.code_writes);
 
 
     }
 
 
+    if (huge_pages)
+    {
+      printf("Guest memory: %d slabs of 2 MiB (%d hugetlb, %d transparent huge pages, %d small pages)\n",
+             memory_slabs(BACKING_HUGETLB) + memory_slabs(BACKING_THP) + memory_slabs(BACKING_SMALL),
+             memory_slabs(BACKING_HUGETLB), memory_slabs(BACKING_THP), memory_slabs(BACKING_SMALL));
+    }
+    if (phase_prof_hz)
+    {
+      phaseprof_stop();
+      phaseprof_report(stdout);
+    }
+    if (host_perf)
+    {
+      hostperf_end(HP_PHASE_REPORT);
+      hostperf_report(stdout, num_insns);
+      hostperf_close();
+    }
+
     memory_delete(mem);
   }
   else {
@@ -1,128 +1,533 @@
 #include "memory.h"
+#include "phaseprof.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Pages hold guest memory as little-endian bytes, so every access width is a
+// plain host load or store at the byte offset within the page.
+//
+// Stores go through a second table with an entry per 4 KiB chunk, split in
+// 16 entries per page that are allocated along with the page. An entry
+// is NULL until the first store to its chunk, and again once the chunk holds
+// decoded code (memory_mark_code), so the only store that pays for code
+// tracking is the first one into a code chunk, which takes the slow path in
+// write_slow() and has the translations of the chunk invalidated. Chunks
+// with a watched range never get an entry, so every store to them is
+// checked against the watch list.
+#define CODE_SHIFT 12
+#define CODE_CHUNK MEMORY_CODE_CHUNK
+#define NUM_CHUNKS (1 << (32 - CODE_SHIFT))
+#define PAGE_CHUNKS (MEMORY_PAGE_SIZE / CODE_CHUNK)
+
+struct watch_range
+{
+  uint32_t addr, size;
+};
 
 struct memory
 {
-  int *pages[0x10000];
+  uint8_t *pages[0x10000];
+  uint8_t **writable[0x10000]; // per page, its chunks or NULL, allocated with it
+  uint32_t code[NUM_CHUNKS / 32]; // chunks holding decoded code
+  memory_code_fn code_written;
+  void *code_ctx;
+  long code_writes; // stores into code chunks
+  uint32_t watched[NUM_CHUNKS / 32]; // chunks overlapping a watched range
+  struct watch_range *watches;
+  int num_watches;
+  int max_watches;
+  memory_watch_fn watch_hit;
+  void *watch_ctx;
+  uint16_t *live; // numbers of the allocated pages
+  int num_live;
+  int max_live;
+  enum misalign_policy misalign;
+  memory_trap_fn trap;
+  void *trap_ctx;
+  long misaligned; // misaligned accesses seen
+  uint8_t *image; // mmap'ed memory image holding some of the pages, or NULL
+  size_t image_size;
+};
+
+// Guest data is little-endian, convert on big-endian hosts
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LE32(x) __builtin_bswap32(x)
+#define LE16(x) __builtin_bswap16(x)
+#else
+#define LE32(x) (x)
+#define LE16(x) (x)
+#endif
+
+// Page pool shared by all memories. Pages are carved from large mmap'ed
+// slabs and never returned to the C heap. Freed pages are kept on one of two
+// stacks: dirty pages still hold guest data and are cleared with memset when
+// reused, clean pages were handed back to the kernel with MADV_DONTNEED and
+// read as zeros. Only a bounded number of dirty pages is kept, so a batch of
+// short runs reuses warm pages while a large freed memory does not stay
+// resident. The pool is not thread safe.
+//
+// With huge pages enabled, slabs are 2 MiB aligned and backed by a hugetlbfs
+// page (MAP_HUGETLB) if the host has one reserved, otherwise by a
+// transparent huge page (MADV_HUGEPAGE), otherwise by normal pages. Freed
+// pages are then always kept dirty, as MADV_DONTNEED would split the huge
+// page again.
+#define PAGE_SIZE MEMORY_PAGE_SIZE
+#define SLAB_PAGES 32       // 2 MiB per slab
+#define SLAB_SIZE (SLAB_PAGES * PAGE_SIZE)
+#define POOL_DIRTY_MAX 64   // dirty pages kept for reuse
+
+static int huge_pages;
+static int slabs[NUM_BACKINGS];
+
+struct page_stack
+{
+  uint8_t **pages;
+  int num;
+  int max;
 };
 
+static struct page_stack clean_pages, dirty_pages;
+
+static void page_push(struct page_stack *s, uint8_t *page)
+{
+  if (s->num == s->max)
+  {
+    s->max = s->max ? 2 * s->max : 256;
+    s->pages = realloc(s->pages, s->max * sizeof(uint8_t *));
+    if (s->pages == NULL)
+    {
+      printf("Out of memory for the page pool\n");
+      exit(-1);
+    }
+  }
+  s->pages[s->num++] = page;
+}
+
+// Map a 2 MiB aligned slab and ask for transparent huge pages on it
+static uint8_t *slab_map_thp(enum memory_backing *backing)
+{
+  uint8_t *map = mmap(NULL, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return map;
+  uint8_t *slab = (uint8_t *)(((uintptr_t)map + SLAB_SIZE - 1) & ~(uintptr_t)(SLAB_SIZE - 1));
+  if (slab > map)
+    munmap(map, slab - map);
+  munmap(slab + SLAB_SIZE, map + SLAB_SIZE - slab);
+  *backing = madvise(slab, SLAB_SIZE, MADV_HUGEPAGE) == 0 ? BACKING_THP : BACKING_SMALL;
+  return slab;
+}
+
+static void slab_alloc(void)
+{
+  uint8_t *slab = MAP_FAILED;
+  enum memory_backing backing = BACKING_SMALL;
+#ifdef MAP_HUGETLB
+  if (huge_pages)
+  {
+    slab = mmap(NULL, SLAB_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    backing = BACKING_HUGETLB;
+  }
+#endif
+  if (slab == MAP_FAILED && huge_pages)
+    slab = slab_map_thp(&backing);
+  if (slab == MAP_FAILED)
+  {
+    slab = mmap(NULL, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    backing = BACKING_SMALL;
+  }
+  if (slab == MAP_FAILED)
+  {
+    printf("Out of memory for guest pages\n");
+    exit(-1);
+  }
+  slabs[backing]++;
+  // pushed in reverse so pages are handed out in address order
+  for (int i = SLAB_PAGES - 1; i >= 0; i--)
+    page_push(&clean_pages, slab + i * PAGE_SIZE);
+}
+
+static uint8_t *page_alloc(void)
+{
+  if (dirty_pages.num)
+  {
+    uint8_t *page = dirty_pages.pages[--dirty_pages.num];
+    memset(page, 0, PAGE_SIZE);
+    return page;
+  }
+  if (clean_pages.num == 0)
+    slab_alloc();
+  return clean_pages.pages[--clean_pages.num];
+}
+
+static void page_free(uint8_t *page)
+{
+  if (dirty_pages.num < POOL_DIRTY_MAX || huge_pages)
+    page_push(&dirty_pages, page);
+  else
+  {
+    madvise(page, PAGE_SIZE, MADV_DONTNEED);
+    page_push(&clean_pages, page);
+  }
+}
+
+void memory_set_huge_pages(int enable)
+{
+  huge_pages = enable;
+}
+
+int memory_slabs(enum memory_backing backing)
+{
+  return slabs[backing];
+}
+
 struct memory *memory_create()
 {
-  return calloc(sizeof(struct memory), 1);
+  struct memory *mem = calloc(sizeof(struct memory), 1);
+  return mem;
 }
 
 void memory_delete(struct memory *mem)
 {
-  for (int j = 0; j < 0x10000; ++j)
+  for (int j = 0; j < mem->num_live; ++j)
   {
-    if (mem->pages[j])
-      free(mem->pages[j]);
+    uint8_t *page = mem->pages[mem->live[j]];
+    if (page < mem->image || page >= mem->image + mem->image_size)
+      page_free(page);
+    free(mem->writable[mem->live[j]]);
   }
+  if (mem->image)
+    munmap(mem->image, mem->image_size);
+  free(mem->live);
+  free(mem->watches);
   free(mem);
 }
 
-int *get_page(struct memory *mem, int addr)
+static void add_live(struct memory *mem, int page_number, uint8_t *page)
+{
+  if (mem->num_live == mem->max_live)
+  {
+    mem->max_live = mem->max_live ? 2 * mem->max_live : 64;
+    mem->live = realloc(mem->live, mem->max_live * sizeof(uint16_t));
+  }
+  mem->live[mem->num_live++] = page_number;
+  mem->pages[page_number] = page;
+  mem->writable[page_number] = calloc(PAGE_CHUNKS, sizeof(uint8_t *));
+}
+
+uint8_t *get_page(struct memory *mem, int addr)
 {
   int page_number = (addr >> 16) & 0x0ffff;
   if (mem->pages[page_number] == NULL)
   {
-    mem->pages[page_number] = calloc(65536, 1);
+    int phase = sim_phase;
+    SET_PHASE(PHASE_MEM_SLOW);
+    add_live(mem, page_number, page_alloc());
+    SET_PHASE(phase);
   }
   return mem->pages[page_number];
 }
 
+// Loading copies whole runs of bytes per page. A page BSS covers entirely
+// is only allocated, pages come from the pool cleared.
+void memory_load(struct memory *mem, uint32_t addr, const void *data, uint32_t size)
+{
+  const uint8_t *src = data;
+  while (size)
+  {
+    uint32_t n = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+    if (n > size)
+      n = size;
+    memcpy(get_page(mem, addr) + (addr & (PAGE_SIZE - 1)), src, n);
+    addr += n;
+    src += n;
+    size -= n;
+  }
+}
+
+void memory_zero(struct memory *mem, uint32_t addr, uint32_t size)
+{
+  while (size)
+  {
+    uint32_t n = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+    if (n > size)
+      n = size;
+    if (mem->pages[addr >> 16] != NULL || n < PAGE_SIZE)
+      memset(get_page(mem, addr) + (addr & (PAGE_SIZE - 1)), 0, n);
+    else
+      get_page(mem, addr);
+    addr += n;
+    size -= n;
+  }
+}
+
+int memory_live_pages(struct memory *mem, const uint16_t **numbers)
+{
+  *numbers = mem->live;
+  return mem->num_live;
+}
+
+const uint8_t *memory_page_data(struct memory *mem, int number)
+{
+  return mem->pages[number & 0xffff];
+}
+
+// Image pages are used in place, copy-on-write through the private mapping.
+// A page the memory already has (program arguments) keeps its own bytes
+// where the image holds zeros, the image was loaded into an empty memory.
+void memory_map_image(struct memory *mem, void *map, size_t map_size,
+                      const uint16_t *numbers, int num, uint8_t *data)
+{
+  for (int i = 0; i < num; i++)
+  {
+    uint8_t *src = data + (size_t)i * PAGE_SIZE;
+    uint8_t *page = mem->pages[numbers[i]];
+    if (page == NULL)
+      add_live(mem, numbers[i], src);
+    else
+    {
+      for (int j = 0; j < PAGE_SIZE; j++)
+        if (src[j])
+          page[j] = src[j];
+    }
+  }
+  if (mem->image)
+    munmap(mem->image, mem->image_size);
+  mem->image = map;
+  mem->image_size = map_size;
+}
+
+static uint8_t *write_slow(struct memory *mem, int addr, int size)
+{
+  uint32_t chunk = (uint32_t)addr >> CODE_SHIFT;
+  uint8_t *page = get_page(mem, addr);
+  if (mem->code[chunk / 32] & (1u << (chunk % 32)))
+  {
+    int phase = sim_phase;
+    SET_PHASE(PHASE_MEM_SLOW);
+    mem->code[chunk / 32] &= ~(1u << (chunk % 32));
+    mem->code_writes++;
+    if (mem->code_written)
+      mem->code_written(mem->code_ctx, chunk << CODE_SHIFT, CODE_CHUNK);
+    SET_PHASE(phase);
+  }
+  uint8_t *base = page + (addr & 0xffff & ~(CODE_CHUNK - 1));
+  if (mem->watched[chunk / 32] & (1u << (chunk % 32)))
+  {
+    for (int i = 0; i < mem->num_watches; i++)
+    {
+      struct watch_range *w = &mem->watches[i];
+      if ((uint32_t)addr < w->addr + w->size && (uint32_t)addr + size > w->addr)
+      {
+        if (mem->watch_hit)
+          mem->watch_hit(mem->watch_ctx, addr, size);
+        break;
+      }
+    }
+    return base;
+  }
+  return mem->writable[chunk / PAGE_CHUNKS][chunk % PAGE_CHUNKS] = base;
+}
+
+// Where a store of size bytes to addr goes
+static inline uint8_t *write_ptr(struct memory *mem, int addr, int size)
+{
+  uint8_t **chunks = mem->writable[(uint32_t)addr >> 16];
+  uint8_t *chunk = chunks ? chunks[((uint32_t)addr >> CODE_SHIFT) % PAGE_CHUNKS] : NULL;
+  if (chunk == NULL)
+    chunk = write_slow(mem, addr, size);
+  return chunk + (addr & (CODE_CHUNK - 1));
+}
+
+// Send the next store to a chunk through write_slow
+static void clear_writable(struct memory *mem, uint32_t chunk)
+{
+  uint8_t **chunks = mem->writable[chunk / PAGE_CHUNKS];
+  if (chunks)
+    chunks[chunk % PAGE_CHUNKS] = NULL;
+}
+
+// Set the watched bit of every chunk that a watch range overlaps
+static void mark_watched(struct memory *mem)
+{
+  memset(mem->watched, 0, sizeof(mem->watched));
+  for (int i = 0; i < mem->num_watches; i++)
+  {
+    struct watch_range *w = &mem->watches[i];
+    for (uint32_t c = w->addr >> CODE_SHIFT; c <= (w->addr + w->size - 1) >> CODE_SHIFT; c++)
+    {
+      mem->watched[c / 32] |= 1u << (c % 32);
+      clear_writable(mem, c);
+    }
+  }
+}
+
+void memory_watch(struct memory *mem, uint32_t addr, uint32_t size)
+{
+  if (mem->num_watches == mem->max_watches)
+  {
+    mem->max_watches = mem->max_watches ? 2 * mem->max_watches : 8;
+    mem->watches = realloc(mem->watches, mem->max_watches * sizeof(struct watch_range));
+  }
+  mem->watches[mem->num_watches].addr = addr;
+  mem->watches[mem->num_watches].size = size ? size : 1;
+  mem->num_watches++;
+  mark_watched(mem);
+}
+
+void memory_unwatch(struct memory *mem, uint32_t addr, uint32_t size)
+{
+  for (int i = 0; i < mem->num_watches; i++)
+  {
+    if (mem->watches[i].addr == addr && mem->watches[i].size == (size ? size : 1))
+    {
+      mem->watches[i] = mem->watches[--mem->num_watches];
+      break;
+    }
+  }
+  mark_watched(mem);
+}
+
+void memory_set_watch_handler(struct memory *mem, memory_watch_fn fn, void *ctx)
+{
+  mem->watch_hit = fn;
+  mem->watch_ctx = ctx;
+}
+
+void memory_mark_code(struct memory *mem, int addr)
+{
+  uint32_t chunk = (uint32_t)addr >> CODE_SHIFT;
+  mem->code[chunk / 32] |= 1u << (chunk % 32);
+  clear_writable(mem, chunk);
+}
+
+void memory_set_code_handler(struct memory *mem, memory_code_fn fn, void *ctx)
+{
+  mem->code_written = fn;
+  mem->code_ctx = ctx;
+}
+
+long memory_code_writes(struct memory *mem)
+{
+  return mem->code_writes;
+}
+
+void memory_set_misalign_policy(struct memory *mem, enum misalign_policy policy)
+{
+  mem->misalign = policy;
+}
+
+enum misalign_policy memory_misalign_policy(struct memory *mem)
+{
+  return mem->misalign;
+}
+
+void memory_set_trap_handler(struct memory *mem, memory_trap_fn fn, void *ctx)
+{
+  mem->trap = fn;
+  mem->trap_ctx = ctx;
+}
+
+long memory_misaligned_count(struct memory *mem)
+{
+  return mem->misaligned;
+}
+
+// Slow path of all misaligned accesses. Returns only when the access is to
+// be emulated.
+static void misaligned(struct memory *mem, int addr, int size, enum memory_access access)
+{
+  static const char *size_names[] = {"", "byte", "halfword", "", "word"};
+  mem->misaligned++;
+  if (mem->trap && (mem->misalign == MISALIGN_TRAP ||
+                    (mem->misalign == MISALIGN_EMULATE && access == ACCESS_FETCH)))
+    mem->trap(mem->trap_ctx, addr, size, access);
+  if (mem->misalign == MISALIGN_EMULATE && access != ACCESS_FETCH)
+    return;
+  printf("Unaligned %s %s %x\n", size_names[size], access == ACCESS_WRITE ? "write to" : "read from", addr);
+  exit(-1);
+}
+
+void memory_misaligned_fetch(struct memory *mem, int addr)
+{
+  misaligned(mem, addr, 4, ACCESS_FETCH);
+}
+
+// Emulated misaligned accesses go byte by byte, so they may cross pages
+static uint32_t rd_bytes(struct memory *mem, int addr, int size)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < size; i++)
+    value |= (uint32_t)memory_rd_b(mem, addr + i) << (8 * i);
+  return value;
+}
+
+static void wr_bytes(struct memory *mem, int addr, int size, uint32_t value)
+{
+  for (int i = 0; i < size; i++)
+    memory_wr_b(mem, addr + i, (int)(value >> (8 * i)));
+}
+
 void memory_wr_w(struct memory *mem, int addr, int data)
 {
   if (addr & 0x3)
   {
-    printf("Unaligned word write to %x\n", addr);
-    exit(-1);
+    misaligned(mem, addr, 4, ACCESS_WRITE);
+    wr_bytes(mem, addr, 4, (uint32_t)data);
+    return;
   }
-  int *page = get_page(mem, addr);
-  page[(addr >> 2) & 0x3fff] = data;
+  uint32_t value = LE32((uint32_t)data);
+  memcpy(write_ptr(mem, addr, 4), &value, 4);
 }
 
 void memory_wr_h(struct memory *mem, int addr, int data)
 {
   if (addr & 0x1)
   {
-    printf("Unaligned halfword write to %x\n", addr);
-    exit(-1);
+    misaligned(mem, addr, 2, ACCESS_WRITE);
+    wr_bytes(mem, addr, 2, (uint32_t)data);
+    return;
   }
-  int *page = get_page(mem, addr);
-  int index = (addr >> 2) & 0x3fff;
-  if ((addr & 2) == 0)
-    page[index] = (page[index] & 0xffff0000) | (data & 0x0000ffff);
-  else
-    page[index] = (page[index] & 0x0000ffff) | ((unsigned)data << 16);
+  uint16_t value = LE16((uint16_t)data);
+  memcpy(write_ptr(mem, addr, 2), &value, 2);
 }
 
 void memory_wr_b(struct memory *mem, int addr, int data)
 {
-  int *page = get_page(mem, addr);
-  int index = (addr >> 2) & 0x3fff;
-  switch (addr & 0x3)
-  {
-  case 0:
-    page[index] = (page[index] & 0xffffff00) | (data & 0xff);
-    break;
-  case 1:
-    page[index] = (page[index] & 0xffff00ff) | ((data & 0xff) << 8);
-    break;
-  case 2:
-    page[index] = (page[index] & 0xff00ffff) | ((data & 0xff) << 16);
-    break;
-  case 3:
-    page[index] = (page[index] & 0x00ffffff) | (((unsigned)(data & 0xff)) << 24);
-    break;
-  }
+  *write_ptr(mem, addr, 1) = (uint8_t)data;
 }
 
 int memory_rd_w(struct memory *mem, int addr)
 {
-  int *page = get_page(mem, addr);
+  uint8_t *page = get_page(mem, addr);
   if (addr & 0x3)
   {
-    printf("Unaligned word read from %x\n", addr);
-    exit(-1);
+    misaligned(mem, addr, 4, ACCESS_READ);
+    return (int)rd_bytes(mem, addr, 4);
   }
-  return page[(addr >> 2) & 0x3fff];
+  uint32_t value;
+  memcpy(&value, page + (addr & 0xffff), 4);
+  return (int)LE32(value);
 }
 
 int memory_rd_h(struct memory *mem, int addr)
 {
-  int *page = get_page(mem, addr);
-  int index = (addr >> 2) & 0x3fff;
+  uint8_t *page = get_page(mem, addr);
   if (addr & 0x1)
   {
-    printf("Unaligned halfword read from %x\n", addr);
-    exit(-1);
+    misaligned(mem, addr, 2, ACCESS_READ);
+    return (int)rd_bytes(mem, addr, 2);
   }
-  if ((addr & 2) == 0)
-    return page[index] & 0xffff;
-  else
-    return (page[index] >> 16) & 0xffff;
+  uint16_t value;
+  memcpy(&value, page + (addr & 0xffff), 2);
+  return LE16(value);
 }
 
 int memory_rd_b(struct memory *mem, int addr)
 {
-  int *page = get_page(mem, addr);
-  int index = (addr >> 2) & 0x3fff;
-  switch (addr & 0x3)
-  {
-  case 0:
-    return page[index] & 0xff;
-    break;
-  case 1:
-    return (page[index] >> 8) & 0xff;
-    break;
-  case 2:
-    return (page[index] >> 16) & 0xff;
-    break;
-  case 3:
-    return (page[index] >> 24) & 0xff;
-    break;
-  }
-  return 0; // silence a warning
+  return get_page(mem, addr)[addr & 0xffff];
 }
@@ -1,6 +1,9 @@
 #ifndef __MEMORY_H__
 #define __MEMORY_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
 struct memory;
 
 // opret/nedlæg lager
@@ -16,4 +19,75 @@ void memory_wr_b(struct memory *mem, int addr, int data);
 int memory_rd_w(struct memory *mem, int addr);
 int memory_rd_h(struct memory *mem, int addr);
 int memory_rd_b(struct memory *mem, int addr);
+
+// indlæs size bytes fra data til lageret fra addr / nulstil size bytes fra
+// addr (BSS). Til indlæsning af programmer: går uden om sporing af kode og
+// watchpoints
+void memory_load(struct memory *mem, uint32_t addr, const void *data, uint32_t size);
+void memory_zero(struct memory *mem, uint32_t addr, uint32_t size);
+
+// brug 2 MiB huge pages til lageret hvis værten tillader det (kald før
+// første memory_create)
+void memory_set_huge_pages(int enable);
+
+// antal 2 MiB slabs tildelt med hver slags sider
+enum memory_backing
+{
+  BACKING_SMALL,   // almindelige sider
+  BACKING_THP,     // transparent huge pages (MADV_HUGEPAGE)
+  BACKING_HUGETLB, // reserverede huge pages (MAP_HUGETLB)
+  NUM_BACKINGS
+};
+int memory_slabs(enum memory_backing backing);
+
+// håndtering af adgange der ikke er justeret til deres størrelse
+enum misalign_policy
+{
+  MISALIGN_ABORT,   // udskriv en fejl og afslut processen (standard)
+  MISALIGN_EMULATE, // udfør adgangen byte for byte, også hen over sidegrænser
+  MISALIGN_TRAP     // kald trap-handleren
+};
+enum memory_access
+{
+  ACCESS_READ,
+  ACCESS_WRITE,
+  ACCESS_FETCH // instruktionshentning, emuleres aldrig
+};
+// trap-handleren må ikke returnere (f.eks. longjmp ud af simulatoren)
+typedef void (*memory_trap_fn)(void *ctx, int addr, int size, enum memory_access access);
+void memory_set_misalign_policy(struct memory *mem, enum misalign_policy policy);
+enum misalign_policy memory_misalign_policy(struct memory *mem);
+void memory_set_trap_handler(struct memory *mem, memory_trap_fn fn, void *ctx);
+// hent instruktion fra en ikke-justeret pc: aborter eller trapper
+void memory_misaligned_fetch(struct memory *mem, int addr);
+// antal ikke-justerede adgange
+long memory_misaligned_count(struct memory *mem);
+
+// selvmodificerende kode: områder på 4 KiB med afkodede instruktioner
+// markeres, og første skrivning til et markeret område kalder handleren
+// (med områdets start og størrelse) og fjerner markeringen igen
+#define MEMORY_CODE_CHUNK 0x1000
+typedef void (*memory_code_fn)(void *ctx, uint32_t addr, uint32_t size);
+void memory_mark_code(struct memory *mem, int addr);
+void memory_set_code_handler(struct memory *mem, memory_code_fn fn, void *ctx);
+// antal skrivninger til markerede områder
+long memory_code_writes(struct memory *mem);
+
+// overvågning af skrivninger (watchpoints): handleren kaldes før hver
+// skrivning der rammer et overvåget område. Lagerområder med overvågning
+// går altid gennem den langsomme vej, resten af lageret påvirkes ikke
+typedef void (*memory_watch_fn)(void *ctx, int addr, int size);
+void memory_watch(struct memory *mem, uint32_t addr, uint32_t size);
+void memory_unwatch(struct memory *mem, uint32_t addr, uint32_t size);
+void memory_set_watch_handler(struct memory *mem, memory_watch_fn fn, void *ctx);
+
+// lagerbilleder (se imagecache.h): de tildelte siders numre og indhold, og
+// indlægning af num sider med numrene i numbers, der ligger efter hinanden
+// fra data i en mmap'et fil. Lageret overtager mappingen (map, map_size) og
+// munmap'er den i memory_delete, dens sider kommer aldrig i sidepuljen
+#define MEMORY_PAGE_SIZE 0x10000
+int memory_live_pages(struct memory *mem, const uint16_t **numbers);
+const uint8_t *memory_page_data(struct memory *mem, int number);
+void memory_map_image(struct memory *mem, void *map, size_t map_size,
+                      const uint16_t *numbers, int num, uint8_t *data);
 #endif
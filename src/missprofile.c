@@ -0,0 +1,83 @@
+#include "missprofile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *column_names[MISSPROFILE_COLUMNS] = {
+    "branches", "nt", "btfnt",
+    "bimodal256", "bimodal1024", "bimodal4096", "bimodal16384",
+    "gshare256", "gshare1024", "gshare4096", "gshare16384"
+};
+
+struct missprofile {
+    long interval;
+    uint32_t *columns[MISSPROFILE_COLUMNS];
+    uint64_t num_rows;
+    uint64_t capacity;
+    struct Stat last;
+};
+
+struct missprofile *missprofile_create(long interval)
+{
+    struct missprofile *p = calloc(1, sizeof(struct missprofile));
+    p->interval = interval;
+    return p;
+}
+
+static void grow(struct missprofile *p)
+{
+    p->capacity = p->capacity ? 2 * p->capacity : 1024;
+    for (int c = 0; c < MISSPROFILE_COLUMNS; c++)
+        p->columns[c] = realloc(p->columns[c], p->capacity * sizeof(uint32_t));
+}
+
+void missprofile_record(struct missprofile *p, const struct Stat *stats)
+{
+    if (p->num_rows == p->capacity)
+        grow(p);
+    const struct Stat *a = &p->last;
+    uint64_t row = p->num_rows++;
+    // every predictor sees every conditional branch, so NT's count is the branch count
+    p->columns[0][row] = stats->nt_predictions - a->nt_predictions;
+    p->columns[1][row] = stats->nt_mispredictions - a->nt_mispredictions;
+    p->columns[2][row] = stats->btfnt_mispredictions - a->btfnt_mispredictions;
+    for (int i = 0; i < 4; i++) {
+        p->columns[3 + i][row] = stats->bimodal_mispredictions[i] - a->bimodal_mispredictions[i];
+        p->columns[7 + i][row] = stats->gshare_mispredictions[i] - a->gshare_mispredictions[i];
+    }
+    p->last = *stats;
+}
+
+int missprofile_write(struct missprofile *p, const struct Stat *final, const char *path)
+{
+    if (final->insns > p->last.insns)
+        missprofile_record(p, final);
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return -1;
+    struct missprofile_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MISSPROFILE_MAGIC, sizeof(h.magic));
+    h.num_columns = MISSPROFILE_COLUMNS;
+    h.interval = p->interval;
+    h.num_rows = p->num_rows;
+    h.total_insns = final->insns;
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    for (int c = 0; c < MISSPROFILE_COLUMNS; c++) {
+        char name[MISSPROFILE_NAME_LEN];
+        memset(name, 0, sizeof(name));
+        strncpy(name, column_names[c], sizeof(name) - 1);
+        ok &= fwrite(name, sizeof(name), 1, f) == 1;
+    }
+    for (int c = 0; c < MISSPROFILE_COLUMNS && p->num_rows; c++)
+        ok &= fwrite(p->columns[c], sizeof(uint32_t), p->num_rows, f) == p->num_rows;
+    ok &= fclose(f) == 0;
+    return ok ? 0 : -1;
+}
+
+void missprofile_delete(struct missprofile *p)
+{
+    for (int c = 0; c < MISSPROFILE_COLUMNS; c++)
+        free(p->columns[c]);
+    free(p);
+}
@@ -0,0 +1,42 @@
+#ifndef __MISSPROFILE_H__
+#define __MISSPROFILE_H__
+
+#include "simulate.h"
+#include <stdint.h>
+
+// Per-interval misprediction profile. Every interval the number of branches
+// and the mispredictions of every predictor since the last interval are
+// recorded. At the end they are written as a columnar binary file:
+//
+//   struct missprofile_header
+//   char name[MISSPROFILE_NAME_LEN] for each column
+//   uint32_t value[num_rows] for each column, one column after the other
+//
+// Values are in host byte order. tools/missprof2csv downsamples and renders it.
+
+#define MISSPROFILE_MAGIC "MISSPRF1"
+#define MISSPROFILE_NAME_LEN 16
+#define MISSPROFILE_COLUMNS 11     // branches, nt, btfnt, bimodal x4, gshare x4
+
+struct missprofile_header {
+    char magic[8];
+    uint32_t num_columns;
+    uint32_t reserved;
+    uint64_t interval;      // instructions per row
+    uint64_t num_rows;
+    uint64_t total_insns;   // the last row may cover fewer instructions
+};
+
+struct missprofile;
+
+struct missprofile *missprofile_create(long interval);
+
+// record the deltas since the previous call, stats are the running totals
+void missprofile_record(struct missprofile *p, const struct Stat *stats);
+
+// record the final partial interval and write the file, returns 0 on success
+int missprofile_write(struct missprofile *p, const struct Stat *final, const char *path);
+
+void missprofile_delete(struct missprofile *p);
+
+#endif
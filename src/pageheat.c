@@ -0,0 +1,198 @@
+#include "pageheat.h"
+#include "elf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HEAT_PAGE_SIZE (1u << HEAT_PAGE_SHIFT)
+
+struct working_set {
+    long insns;             // at the end of the interval
+    int touched;            // 4 KiB pages
+    int allocated;          // 64 KiB memory pages
+};
+
+struct pageheat *pageheat_create(struct memory *mem, long interval, long sample_period)
+{
+    struct pageheat *h = calloc(1, sizeof(struct pageheat));
+    h->mem = mem;
+    h->interval = interval;
+    h->interval_end = interval;
+    h->current = 1;
+    h->sample_period = sample_period;
+    h->on = 1;
+    return h;
+}
+
+static void end_interval(struct pageheat *h, long insns)
+{
+    if (h->num_sets == h->max_sets) {
+        h->max_sets = h->max_sets ? 2 * h->max_sets : 256;
+        h->sets = realloc(h->sets, h->max_sets * sizeof(struct working_set));
+    }
+    const uint16_t *numbers;
+    struct working_set *s = &h->sets[h->num_sets++];
+    s->insns = insns;
+    s->touched = h->touched;
+    s->allocated = memory_live_pages(h->mem, &numbers);
+    h->touched = 0;
+    h->current++;
+}
+
+void pageheat_next_interval(struct pageheat *h)
+{
+    end_interval(h, h->interval_end);
+    h->interval_end += h->interval;
+}
+
+struct page_heat *pageheat_new_page(struct pageheat *h, uint32_t addr)
+{
+    return h->heat[addr >> 16] = calloc(HEAT_PAGES, sizeof(struct page_heat));
+}
+
+// A page of the report
+struct hot_page {
+    uint32_t addr;
+    const struct page_heat *heat;
+    long accesses;
+};
+
+static int compare_accesses(const void *a, const void *b)
+{
+    const struct hot_page *x = a, *y = b;
+    if (x->accesses != y->accesses)
+        return x->accesses > y->accesses ? -1 : 1;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static uint32_t overlap(uint32_t start, uint32_t end, uint32_t addr)
+{
+    uint32_t lo = start > addr ? start : addr;
+    uint32_t hi = end < addr + HEAT_PAGE_SIZE ? end : addr + HEAT_PAGE_SIZE;
+    return hi > lo ? hi - lo : 0;
+}
+
+// The section covering most of the page at addr, or NULL
+static const char *owning_section(const struct elf_section *sections, int num, uint32_t addr)
+{
+    const char *best = NULL;
+    uint32_t most = 0;
+    for (int i = 0; i < num; i++) {
+        uint32_t n = overlap(sections[i].start, sections[i].end, addr);
+        if (n > most) {
+            most = n;
+            best = sections[i].name;
+        }
+    }
+    return best;
+}
+
+// The function or object covering most of the page at addr, or else the
+// closest one below it
+static void owning_symbol(struct symbols *symbols, uint32_t addr, char *buf, size_t size)
+{
+    const void *symtab;
+    const char *strtab;
+    unsigned int strtab_size;
+    int num = symbols ? symbols_tables(symbols, &symtab, &strtab, &strtab_size) : 0;
+    const Elf32_Sym *syms = symtab;
+    const Elf32_Sym *best = NULL, *below = NULL;
+    uint32_t most = 0;
+    for (int i = 0; i < num; i++) {
+        const Elf32_Sym *sym = &syms[i];
+        int type = ELF32_ST_TYPE(sym->st_info);
+        if ((type != STT_FUNC && type != STT_OBJECT) || sym->st_shndx == SHN_UNDEF
+            || sym->st_shndx == SHN_ABS || sym->st_name >= strtab_size)
+            continue;
+        uint32_t n = overlap(sym->st_value, sym->st_value + sym->st_size, addr);
+        if (n > most) {
+            most = n;
+            best = sym;
+        }
+        if (sym->st_value <= addr && (!below || sym->st_value > below->st_value))
+            below = sym;
+    }
+    if (best)
+        snprintf(buf, size, "%s", strtab + best->st_name);
+    else if (below)
+        snprintf(buf, size, "%s+0x%x", strtab + below->st_name, addr - below->st_value);
+    else
+        snprintf(buf, size, "-");
+}
+
+int pageheat_write(struct pageheat *h, const char *path, int top,
+                   const struct elf_section *sections, int num_sections, struct symbols *symbols)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+    if (h->insns > h->interval_end - h->interval)
+        end_interval(h, h->insns);
+
+    if (h->sample_period)
+        fprintf(f, "# accesses of 1 in every %ld instructions\n", h->sample_period);
+    fprintf(f, "# working set per %ld instructions: 4 KiB pages touched in the interval,"
+               " 64 KiB pages allocated at its end\n", h->interval);
+    fprintf(f, "%14s %10s %10s %10s %10s\n", "insns", "touched", "KiB", "allocated", "KiB");
+    int peak_touched = 0, peak_allocated = 0;
+    for (int i = 0; i < h->num_sets; i++) {
+        const struct working_set *s = &h->sets[i];
+        fprintf(f, "%14ld %10d %10d %10d %10d\n", s->insns, s->touched, s->touched * 4,
+                s->allocated, s->allocated * 64);
+        if (s->touched > peak_touched)
+            peak_touched = s->touched;
+        if (s->allocated > peak_allocated)
+            peak_allocated = s->allocated;
+    }
+
+    int num = 0, max = 256;
+    struct hot_page *pages = malloc(max * sizeof(struct hot_page));
+    for (uint32_t m = 0; m < 0x10000; m++) {
+        if (!h->heat[m])
+            continue;
+        for (uint32_t i = 0; i < HEAT_PAGES; i++) {
+            const struct page_heat *p = &h->heat[m][i];
+            if (!p->first)
+                continue;
+            if (num == max) {
+                max *= 2;
+                pages = realloc(pages, max * sizeof(struct hot_page));
+            }
+            pages[num].addr = m << 16 | i << HEAT_PAGE_SHIFT;
+            pages[num].heat = p;
+            pages[num++].accesses = p->count[HEAT_READ] + p->count[HEAT_WRITE] + p->count[HEAT_FETCH];
+        }
+    }
+    fprintf(f, "# peak %d pages touched (%d KiB) in an interval, %d pages allocated (%d KiB),"
+               " %d pages touched in all (%d KiB)\n",
+            peak_touched, peak_touched * 4, peak_allocated, peak_allocated * 64, num, num * 4);
+
+    qsort(pages, num, sizeof(struct hot_page), compare_accesses);
+    if (top > num)
+        top = num;
+    fprintf(f, "# hottest %d pages\n", top);
+    fprintf(f, "%-10s %12s %12s %12s %14s %14s  %-16s %s\n",
+            "page", "reads", "writes", "fetches", "first", "last", "section", "symbol");
+    for (int i = 0; i < top; i++) {
+        const struct page_heat *p = pages[i].heat;
+        const char *section = owning_section(sections, num_sections, pages[i].addr);
+        char symbol[256];
+        if (section)
+            owning_symbol(symbols, pages[i].addr, symbol, sizeof(symbol));
+        else
+            snprintf(symbol, sizeof(symbol), "-");
+        fprintf(f, "0x%08x %12ld %12ld %12ld %14ld %14ld  %-16s %s\n", pages[i].addr,
+                p->count[HEAT_READ], p->count[HEAT_WRITE], p->count[HEAT_FETCH],
+                p->first, p->last, section ? section : "-", symbol);
+    }
+    free(pages);
+    return fclose(f) ? -1 : 0;
+}
+
+void pageheat_delete(struct pageheat *h)
+{
+    for (int m = 0; m < 0x10000; m++)
+        free(h->heat[m]);
+    free(h->sets);
+    free(h);
+}
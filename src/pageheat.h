@@ -0,0 +1,92 @@
+#ifndef __PAGEHEAT_H__
+#define __PAGEHEAT_H__
+
+#include "memory.h"
+#include "read_elf.h"
+#include <stdint.h>
+
+// Memory page heat: reads, writes and fetches per 4 KiB page of guest
+// memory with the instructions of the first and last access, and the
+// working set over time, the pages touched in every interval of
+// instructions next to the 64 KiB pages the memory has allocated (what the
+// run costs the host). The counters of a 64 KiB page are allocated on its
+// first access, so memory grows with the pages the program touches.
+//
+// With a sample period only the accesses of every period'th instruction
+// are counted, which thins out the counts evenly but may miss pages
+// touched only rarely. The reference interpreter feeds it, so a run with
+// page heat uses ENGINE_SWITCH.
+
+#define HEAT_READ 0
+#define HEAT_WRITE 1
+#define HEAT_FETCH 2
+
+#define HEAT_PAGE_SHIFT 12
+#define HEAT_PAGES (MEMORY_PAGE_SIZE >> HEAT_PAGE_SHIFT)   // per memory page
+
+struct page_heat {
+    long count[3];          // by HEAT_READ, HEAT_WRITE, HEAT_FETCH
+    long first, last;       // instructions, first is 0 until the page is touched
+    long interval;          // the last one it was touched in
+};
+
+struct working_set;
+
+struct pageheat {
+    long insns;             // the instruction running
+    int on;                 // its accesses are counted
+    long sample_period;     // instructions, 0 to count all of them
+    long interval;          // instructions per working set interval
+    long interval_end;      // last instruction of the current interval
+    long current;           // number of the current interval, from 1
+    int touched;            // pages touched in it
+    struct page_heat *heat[0x10000];  // per memory page, NULL until touched
+    struct memory *mem;
+    struct working_set *sets;   // the intervals ended so far
+    int num_sets;
+    int max_sets;
+};
+
+struct pageheat *pageheat_create(struct memory *mem, long interval, long sample_period);
+
+// slow paths of the functions below
+void pageheat_next_interval(struct pageheat *h);
+struct page_heat *pageheat_new_page(struct pageheat *h, uint32_t addr);
+
+// called before every instruction with the count including it
+static inline void pageheat_insn(struct pageheat *h, long insns){
+    h->insns = insns;
+    if (insns > h->interval_end)
+        pageheat_next_interval(h);
+    if (h->sample_period)
+        h->on = (insns - 1) % h->sample_period == 0;
+}
+
+static inline void pageheat_access(struct pageheat *h, int kind, uint32_t addr){
+    if (!h->on)
+        return;
+    struct page_heat *p = h->heat[addr >> 16];
+    if (!p)
+        p = pageheat_new_page(h, addr);
+    p += (addr >> HEAT_PAGE_SHIFT) & (HEAT_PAGES - 1);
+    p->count[kind]++;
+    if (p->interval != h->current) {
+        p->interval = h->current;
+        h->touched++;
+        if (!p->first)
+            p->first = h->insns;
+    }
+    p->last = h->insns;
+}
+
+#define PAGE_HEAT_TOP 20   // pages listed by --page-heat
+
+// Write the working set per interval and the top hottest pages by
+// accesses, each with the section and symbol it belongs to (sections may be
+// NULL, pages outside the ELF file get neither). Returns 0 on success.
+int pageheat_write(struct pageheat *h, const char *path, int top,
+                   const struct elf_section *sections, int num_sections, struct symbols *symbols);
+
+void pageheat_delete(struct pageheat *h);
+
+#endif
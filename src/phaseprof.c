@@ -0,0 +1,60 @@
+#include "phaseprof.h"
+#include <string.h>
+#include <sys/time.h>
+
+volatile sig_atomic_t sim_phase = PHASE_OUTSIDE;
+
+static volatile long samples[NUM_PHASES];
+
+static const char *phase_names[NUM_PHASES] = {
+    "outside simulate", "fetch", "decode", "execute alu", "execute mul/div",
+    "execute load", "execute store", "execute branch", "execute jump",
+    "execute lui/auipc", "predictor update", "logging", "memory slow path", "ecall"
+};
+
+static void on_sample(int sig)
+{
+    (void)sig;
+    int phase = sim_phase;
+    if (phase >= 0 && phase < NUM_PHASES)
+        samples[phase]++;
+}
+
+int phaseprof_start(int hz)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sample;
+    sa.sa_flags = SA_RESTART;   // don't break getchar() in the ecall handler
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL))
+        return -1;
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 1 / hz;
+    timer.it_interval.tv_usec = 1000000 / hz % 1000000;
+    timer.it_value = timer.it_interval;
+    return setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void phaseprof_stop(void)
+{
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    signal(SIGPROF, SIG_IGN);
+}
+
+void phaseprof_report(FILE *out)
+{
+    long total = 0;
+    for (int p = 0; p < NUM_PHASES; p++)
+        total += samples[p];
+    fprintf(out, "\nSimulator phase profile (%ld samples):\n", total);
+    if (total == 0)
+        return;
+    for (int p = 0; p < NUM_PHASES; p++) {
+        if (samples[p])
+            fprintf(out, "  %-20s %8ld  %6.2f%%\n", phase_names[p], samples[p],
+                    samples[p] * 100.0 / total);
+    }
+}
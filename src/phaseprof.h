@@ -0,0 +1,39 @@
+#ifndef __PHASEPROF_H__
+#define __PHASEPROF_H__
+
+#include <stdio.h>
+#include <signal.h>
+
+// Sampling profiler of simulator phases. The simulator marks the phase it is
+// in by storing to sim_phase; a SIGPROF timer samples it. Started by --phase-prof.
+
+enum sim_phase {
+    PHASE_OUTSIDE,      // not in simulate(): loading, reporting
+    PHASE_FETCH,
+    PHASE_DECODE,
+    PHASE_EXEC_ALU,
+    PHASE_EXEC_MULDIV,
+    PHASE_EXEC_LOAD,
+    PHASE_EXEC_STORE,
+    PHASE_EXEC_BRANCH,
+    PHASE_EXEC_JUMP,
+    PHASE_EXEC_UPPER,   // lui, auipc
+    PHASE_PREDICTOR,
+    PHASE_LOGGING,
+    PHASE_MEM_SLOW,     // page allocation in memory.c
+    PHASE_ECALL,
+    NUM_PHASES
+};
+
+extern volatile sig_atomic_t sim_phase;
+
+#define SET_PHASE(p) (sim_phase = (p))
+
+// start sampling at the given rate (samples per second of cpu time)
+int phaseprof_start(int hz);
+void phaseprof_stop(void);
+
+// print the number of samples and share of time per phase
+void phaseprof_report(FILE *out);
+
+#endif
@@ -0,0 +1,33 @@
+#include "predict.h"
+
+uint8_t bimodal[BIMODAL_LEVELS][BIMODAL_MAX];
+const int bimodal_sizes[BIMODAL_LEVELS] = {256, 1024, 4096, 16384};
+
+uint8_t gshare[BIMODAL_LEVELS][GSHARE_MAX];
+uint32_t ghr[BIMODAL_LEVELS];
+
+void predict_init(struct Stat *stats)
+{
+    stats->nt_predictions = 0;
+    stats->nt_mispredictions = 0;
+
+    stats->btfnt_predictions = 0;
+    stats->btfnt_mispredictions = 0;
+
+    for (int i = 0; i < BIMODAL_LEVELS; i++) {
+        for (int j = 0; j < bimodal_sizes[i]; j++) {
+            bimodal[i][j] = 1;
+        }
+        stats->bimodal_predictions[i] = 0;
+        stats->bimodal_mispredictions[i] = 0;
+    }
+
+    for (int i = 0; i < BIMODAL_LEVELS; i++) {
+        for (int j = 0; j < bimodal_sizes[i]; j++) {
+            gshare[i][j] = 1;  // weakly not taken
+        }
+        ghr[i] = 0;
+        stats->gshare_predictions[i] = 0;
+        stats->gshare_mispredictions[i] = 0;
+    }
+}
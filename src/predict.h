@@ -0,0 +1,67 @@
+#ifndef __PREDICT_H__
+#define __PREDICT_H__
+
+#include "simulate.h"
+#include <stdint.h>
+
+// Branch predictors evaluated on every conditional branch: NT, BTFNT and
+// bimodal and gShare tables at four sizes. Shared by all execution engines.
+
+#define BIMODAL_LEVELS 4
+#define BIMODAL_MAX 16384
+
+#define GSHARE_MAX 16384
+
+extern uint8_t bimodal[BIMODAL_LEVELS][BIMODAL_MAX];
+extern const int bimodal_sizes[BIMODAL_LEVELS];
+
+extern uint8_t gshare[BIMODAL_LEVELS][GSHARE_MAX];
+extern uint32_t ghr[BIMODAL_LEVELS];
+
+// reset predictor tables and the prediction counters in stats
+void predict_init(struct Stat *stats);
+
+// Update all predictors with the outcome of the conditional branch at pc
+static inline void predict_branch(struct Stat *stats, uint32_t pc, uint32_t target, int take)
+{
+    stats->nt_predictions++;
+    if (take)
+        stats->nt_mispredictions++;
+
+    stats->btfnt_predictions++;
+    int btfnt_pred_taken = (target < pc);
+    if (btfnt_pred_taken != take)
+        stats->btfnt_mispredictions++;
+
+    for (int i = 0; i < BIMODAL_LEVELS; i++) {
+        int size = bimodal_sizes[i];
+        int index = (pc >> 2) & (size - 1);
+
+        int pred = (bimodal[i][index] >= 2);
+        stats->bimodal_predictions[i]++;
+
+        if (pred != take)
+            stats->bimodal_mispredictions[i]++;
+
+        if (take && bimodal[i][index] < 3) bimodal[i][index]++;
+        if (!take && bimodal[i][index] > 0) bimodal[i][index]--;
+    }
+
+    for (int i = 0; i < BIMODAL_LEVELS; i++) {
+        int size = bimodal_sizes[i];
+        int index = ((pc >> 2) ^ ghr[i]) & (size - 1);
+
+        int pred = (gshare[i][index] >= 2);
+        stats->gshare_predictions[i]++;
+
+        if (pred != take)
+            stats->gshare_mispredictions[i]++;
+
+        if (take && gshare[i][index] < 3) gshare[i][index]++;
+        if (!take && gshare[i][index] > 0) gshare[i][index]--;
+
+        ghr[i] = ((ghr[i] << 1) | (take ? 1 : 0)) & (size - 1);
+    }
+}
+
+#endif
@@ -6,6 +6,22 @@
 #include <string.h>
 #include "elf.h"
 
+// Record an executable range, text_start and text_end span all of them.
+// Returns -1 if there are more than MAX_REGIONS of them.
+static int add_text(struct program_info* info, unsigned int start, unsigned int end) {
+    if (info->num_text == MAX_REGIONS)
+        return -1;
+    struct elf_region *text = &info->text[info->num_text++];
+    text->start = start;
+    text->end = end;
+    text->flags = REGION_X;
+    if (info->num_text == 1 || start < info->text_start)
+        info->text_start = start;
+    if (end > info->text_end)
+        info->text_end = end;
+    return 0;
+}
+
 int read_elf(struct memory* mem, struct program_info* info, const char *filename, FILE *log_file) {
     FILE *file = fopen(filename, "rb");
     if (!file) {
@@ -33,6 +49,8 @@ int read_elf(struct memory* mem, struct program_info* info, const char *filename
     info->text_start = 0;
     info->text_end = 0;
     info->start = elf_header.e_entry;
+    info->num_regions = 0;
+    info->num_text = 0;
     //printf("Program headers starting at offset %d\n", elf_header.e_phoff);
     //printf("Program entry point address: 0x%x\n", info->start);
     //printf("Text offset 0x%x\n\n", info->text_start);
@@ -48,24 +66,28 @@ int read_elf(struct memory* mem, struct program_info* info, const char *filename
 
         // Check for loadable segments (PT_LOAD)
         if (program_header.p_type == PT_LOAD) {
-            // const char *segment_type = NULL;
-
-            // Identify segment type
-            if (program_header.p_flags & PF_X) {
-                // segment_type = "Executable (.text)";
-                info->text_start = program_header.p_vaddr + (unsigned int)(sizeof(Elf32_Ehdr) + elf_header.e_phnum * sizeof(Elf32_Phdr));
-                info->text_end = program_header.p_vaddr + program_header.p_filesz;
-            } else if (program_header.p_flags & PF_W) {
-                // segment_type = "Writable (static data)";
-            } else {
-                // segment_type = "Read-only (e.g., .rodata)";
+            if (info->num_regions == MAX_REGIONS) {
+                fprintf(log_file, "Elf file error, more than %d loadable segments.\n", MAX_REGIONS);
+                fclose(file);
+                return -1;
             }
+            struct elf_region *region = &info->regions[info->num_regions++];
+            region->start = program_header.p_vaddr;
+            region->end = program_header.p_vaddr + program_header.p_memsz;
+            region->flags = program_header.p_flags & (PF_R | PF_W | PF_X);
 
-            //printf("Found %s segment at offset 0x%x, size 0x%x, in-memory address 0x%x\n",
-            //      segment_type, program_header.p_offset, program_header.p_filesz, program_header.p_vaddr);
+            // Without section headers, executable segments are the text,
+            // less the ELF and program headers if the segment maps them
+            if ((program_header.p_flags & PF_X) && elf_header.e_shnum == 0) {
+                unsigned int headers_end = elf_header.e_phoff + elf_header.e_phnum * sizeof(Elf32_Phdr);
+                unsigned int skip = program_header.p_offset < headers_end ? headers_end - program_header.p_offset : 0;
+                // no overflow, there are no more of them than segments
+                if (skip < program_header.p_filesz)
+                    add_text(info, program_header.p_vaddr + skip, program_header.p_vaddr + program_header.p_filesz);
+            }
 
             // Allocate buffer for the segment
-            unsigned char *segment_data = malloc(program_header.p_filesz);
+            unsigned char *segment_data = malloc(program_header.p_filesz + 1);
             if (!segment_data) {
                 fprintf(log_file, "Error allocating memory for segment\n");
                 fclose(file);
@@ -79,35 +101,92 @@ int read_elf(struct memory* mem, struct program_info* info, const char *filename
                 fprintf(log_file, "Error reading segment - failed to read entire segment in one go\n");
                 return -1;
             }
-
-            // Process the segment data (e.g., print or analyze)
-            // printf("All bytes of %s segment:\n", segment_type);
-            for (unsigned int j = 0; j < program_header.p_filesz; j++) {
-                // printf("%02x ", segment_data[j]);
-                memory_wr_b(mem, program_header.p_vaddr + j, segment_data[j]);
-            }
-            /*
-            printf("\n\nDisassembly\n");
-            for (unsigned int j = info->text_start; j < program_header.p_filesz; j += 4) {
-                unsigned int addr = program_header.p_vaddr + j;
-                int inst = memory_rd_w(mem, addr);
-                const int buf_sz = 64;
-                char buf[buf_sz];
-                decode_rv32i(addr, inst, buf, buf_sz);
-                // printf("%6x %8x   %s\n", j, inst, buf);
-            }
-            printf("\n");
-            */
+            memory_load(mem, program_header.p_vaddr, segment_data, program_header.p_filesz);
+            // the rest of the segment is BSS
+            if (program_header.p_memsz > program_header.p_filesz)
+                memory_zero(mem, program_header.p_vaddr + program_header.p_filesz,
+                            program_header.p_memsz - program_header.p_filesz);
             free(segment_data);
         }
     }
+
+    // The executable sections are the text. Unlike the segments they leave
+    // out the headers and read-only data sharing the pages of the code.
+    Elf32_Shdr section_header;
+    for (int i = 0; i < elf_header.e_shnum; i++) {
+        fseek(file, elf_header.e_shoff + i * sizeof(Elf32_Shdr), SEEK_SET);
+        if (fread(&section_header, 1, sizeof(Elf32_Shdr), file) != sizeof(Elf32_Shdr)) {
+            fprintf(log_file, "Elf file error, file shorter than its section headers.\n");
+            fclose(file);
+            return -1;
+        }
+        if ((section_header.sh_flags & (SHF_ALLOC | SHF_EXECINSTR)) == (SHF_ALLOC | SHF_EXECINSTR)
+            && section_header.sh_type == SHT_PROGBITS && section_header.sh_size > 0
+            && add_text(info, section_header.sh_addr, section_header.sh_addr + section_header.sh_size)) {
+            fprintf(log_file, "Elf file error, more than %d executable sections.\n", MAX_REGIONS);
+            fclose(file);
+            return -1;
+        }
+    }
     // adjust program info to virtual addresses instead of file offsets
     fclose(file);
     return 0;
 }
 
+static int compare_sections(const void* a, const void* b) {
+    unsigned int x = ((const struct elf_section*)a)->start, y = ((const struct elf_section*)b)->start;
+    return x < y ? -1 : x > y;
+}
+
+int read_elf_sections(const char* file_name, struct elf_section** sections) {
+    FILE *file = fopen(file_name, "rb");
+    if (!file)
+        return -1;
+    Elf32_Ehdr elf_header;
+    Elf32_Shdr *headers = NULL;
+    char *names = NULL;
+    int ok = fread(&elf_header, 1, sizeof(Elf32_Ehdr), file) == sizeof(Elf32_Ehdr)
+             && memcmp(elf_header.e_ident, ELFMAG, SELFMAG) == 0
+             && elf_header.e_shnum > 0 && elf_header.e_shstrndx < elf_header.e_shnum;
+    if (ok) {
+        headers = malloc(elf_header.e_shnum * sizeof(Elf32_Shdr));
+        ok = fseek(file, elf_header.e_shoff, SEEK_SET) == 0
+             && fread(headers, sizeof(Elf32_Shdr), elf_header.e_shnum, file) == elf_header.e_shnum;
+    }
+    Elf32_Shdr *strings = ok ? &headers[elf_header.e_shstrndx] : NULL;
+    if (ok) {
+        names = malloc(strings->sh_size + 1);
+        ok = fseek(file, strings->sh_offset, SEEK_SET) == 0
+             && fread(names, 1, strings->sh_size, file) == strings->sh_size;
+    }
+    fclose(file);
+    if (!ok) {
+        free(headers);
+        free(names);
+        return -1;
+    }
+    names[strings->sh_size] = 0;
+
+    int num = 0;
+    *sections = malloc(elf_header.e_shnum * sizeof(struct elf_section));
+    for (int i = 0; i < elf_header.e_shnum; i++) {
+        if (!(headers[i].sh_flags & SHF_ALLOC) || headers[i].sh_size == 0)
+            continue;
+        struct elf_section *s = &(*sections)[num++];
+        s->start = headers[i].sh_addr;
+        s->end = headers[i].sh_addr + headers[i].sh_size;
+        snprintf(s->name, sizeof(s->name), "%s",
+                 headers[i].sh_name < strings->sh_size ? names + headers[i].sh_name : "");
+    }
+    qsort(*sections, num, sizeof(struct elf_section), compare_sections);
+    free(headers);
+    free(names);
+    return num;
+}
+
 struct symbols {
     char* strtab;
+    unsigned int strtab_size;
     Elf32_Sym* symbols;
     int num_symbols;
 };
@@ -169,6 +248,7 @@ struct symbols* symbols_read_from_elf(const char *filename) {
     struct symbols* symbols = malloc(sizeof(struct symbols));
     // Read the string table
     symbols->strtab = malloc(strtab_section->sh_size);
+    symbols->strtab_size = strtab_section->sh_size;
     fseek(file, strtab_section->sh_offset, SEEK_SET);
     status = fread(symbols->strtab, 1, strtab_section->sh_size, file);
     if ((unsigned int)status != strtab_section->sh_size) {
@@ -211,6 +291,8 @@ struct symbols* symbols_read_from_elf(const char *filename) {
 
 const char* symbols_value_to_sym(struct symbols* symbols, unsigned int value) 
 {
+    if (!symbols)
+        return NULL;
     for (int i = 0; i < symbols->num_symbols; i++) {
         if (symbols->symbols[i].st_value == value && ELF32_ST_BIND(symbols->symbols[i].st_info)) {
             return &symbols->strtab[symbols->symbols[i].st_name];
@@ -219,6 +301,60 @@ const char* symbols_value_to_sym(struct symbols* symbols, unsigned int value)
     return NULL;
 }
 
+const char* symbols_addr_to_func(struct symbols* symbols, unsigned int addr, unsigned int* offset)
+{
+    if (!symbols)
+        return NULL;
+    const Elf32_Sym* best = NULL;
+    for (int i = 0; i < symbols->num_symbols; i++) {
+        const Elf32_Sym* sym = &symbols->symbols[i];
+        // functions, and global labels such as _start
+        int code = ELF32_ST_TYPE(sym->st_info) == STT_FUNC
+                   || (ELF32_ST_TYPE(sym->st_info) == STT_NOTYPE && ELF32_ST_BIND(sym->st_info) == STB_GLOBAL
+                       && sym->st_shndx != SHN_ABS && sym->st_shndx != SHN_UNDEF);
+        if (code && sym->st_value <= addr
+            && (!best || sym->st_value > best->st_value))
+            best = sym;
+    }
+    if (!best)
+        return NULL;
+    *offset = addr - best->st_value;
+    return &symbols->strtab[best->st_name];
+}
+
+int symbols_sym_to_value(struct symbols* symbols, const char* name, unsigned int* value)
+{
+    if (!symbols)
+        return -1;
+    for (int i = 0; i < symbols->num_symbols; i++) {
+        if (!strcmp(&symbols->strtab[symbols->symbols[i].st_name], name)) {
+            *value = symbols->symbols[i].st_value;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+struct symbols* symbols_create(const void* symtab, int num_symbols, const char* strtab, unsigned int strtab_size)
+{
+    struct symbols* symbols = malloc(sizeof(struct symbols));
+    symbols->num_symbols = num_symbols;
+    symbols->symbols = malloc(num_symbols * sizeof(Elf32_Sym));
+    memcpy(symbols->symbols, symtab, num_symbols * sizeof(Elf32_Sym));
+    symbols->strtab_size = strtab_size;
+    symbols->strtab = malloc(strtab_size);
+    memcpy(symbols->strtab, strtab, strtab_size);
+    return symbols;
+}
+
+int symbols_tables(struct symbols* symbols, const void** symtab, const char** strtab, unsigned int* strtab_size)
+{
+    *symtab = symbols->symbols;
+    *strtab = symbols->strtab;
+    *strtab_size = symbols->strtab_size;
+    return symbols->num_symbols;
+}
+
 void symbols_delete(struct symbols* symbols)
 {
     free(symbols->strtab);
@@ -5,15 +5,45 @@
 
 #include <stdio.h>
 
+#define MAX_REGIONS 16
+
+// region permissions, the values of the ELF segment flags
+#define REGION_X 1
+#define REGION_W 2
+#define REGION_R 4
+
+struct elf_region {
+    unsigned int start;
+    unsigned int end;
+    unsigned int flags;
+};
+
 struct program_info {
-    unsigned int text_start;
+    unsigned int text_start;    // from the lowest to the highest text address
     unsigned int text_end;
     unsigned int start;
+    // the loaded segments, BSS included
+    int num_regions;
+    struct elf_region regions[MAX_REGIONS];
+    // the executable sections, or executable segments if there are no
+    // section headers
+    int num_text;
+    struct elf_region text[MAX_REGIONS];
 };
 
 // read file into simulated memory, fill in program info
 int read_elf(struct memory* mem, struct program_info* info, const char* file_name, FILE *log_file);
 
+// the allocated sections (SHF_ALLOC) of file, by address. Returns their
+// number and a malloc'ed array in *sections, or -1 if the file has no
+// section headers or cannot be read
+struct elf_section {
+    unsigned int start;
+    unsigned int end;
+    char name[32];
+};
+int read_elf_sections(const char* file_name, struct elf_section** sections);
+
 // You can use the following functions to "pretty-print" numbers as symbols in case matching
 // symbol definitions exist in the elf file. Doing so is entirely optional.
 struct symbols;
@@ -27,5 +57,17 @@ void symbols_delete(struct symbols* symbols);
 // map a value to a symbol (return NULL if no matching symbol found)
 const char* symbols_value_to_sym(struct symbols* symbols, unsigned int value);
 
+// the function containing addr (the closest function symbol at or below
+// it), with addr's offset into it, or NULL
+const char* symbols_addr_to_func(struct symbols* symbols, unsigned int addr, unsigned int* offset);
+
+// map a symbol to its value (return -1 if there is no such symbol)
+int symbols_sym_to_value(struct symbols* symbols, const char* name, unsigned int* value);
+
+// the raw ELF symbol table (num_symbols Elf32_Sym entries) and string table
+// behind a symbol table, and a symbol table made from copies of them, so
+// they can be stored elsewhere (see imagecache.h)
+int symbols_tables(struct symbols* symbols, const void** symtab, const char** strtab, unsigned int* strtab_size);
+struct symbols* symbols_create(const void* symtab, int num_symbols, const char* strtab, unsigned int strtab_size);
 
 #endif
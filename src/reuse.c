@@ -0,0 +1,187 @@
+#include "reuse.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EMPTY 0xffffffffu
+
+struct reuse {
+    int line_shift;
+    // line -> time of its last access, open addressing
+    uint32_t *keys;
+    uint32_t *times;
+    uint32_t hash_size;     // power of two
+    uint32_t lines;         // distinct lines so far
+    // Fenwick tree over times [0, capacity), 1 where a line was last accessed
+    uint32_t *tree;
+    uint32_t capacity;
+    uint32_t now;
+    // hist[d] accesses at distance d, for d < lines
+    uint64_t *hist;
+    uint32_t hist_size;
+    uint64_t accesses;
+};
+
+static uint32_t hash(uint32_t line)
+{
+    return line * 0x9e3779b1u;
+}
+
+static void tree_add(struct reuse *r, uint32_t t, int v)
+{
+    for (uint32_t i = t + 1; i <= r->capacity; i += i & -i)
+        r->tree[i] += v;
+}
+
+// marked times before t
+static uint32_t tree_sum(const struct reuse *r, uint32_t t)
+{
+    uint32_t s = 0;
+    for (uint32_t i = t; i > 0; i -= i & -i)
+        s += r->tree[i];
+    return s;
+}
+
+static uint32_t *slot(struct reuse *r, uint32_t line)
+{
+    uint32_t mask = r->hash_size - 1;
+    uint32_t i = hash(line) & mask;
+    while (r->keys[i] != EMPTY && r->keys[i] != line)
+        i = (i + 1) & mask;
+    return &r->keys[i];
+}
+
+static void grow_hash(struct reuse *r)
+{
+    uint32_t *keys = r->keys, *times = r->times;
+    uint32_t old_size = r->hash_size;
+    r->hash_size *= 2;
+    r->keys = malloc(r->hash_size * sizeof(uint32_t));
+    r->times = malloc(r->hash_size * sizeof(uint32_t));
+    memset(r->keys, 0xff, r->hash_size * sizeof(uint32_t));
+    for (uint32_t i = 0; i < old_size; i++) {
+        if (keys[i] != EMPTY) {
+            uint32_t *k = slot(r, keys[i]);
+            *k = keys[i];
+            r->times[k - r->keys] = times[i];
+        }
+    }
+    free(keys);
+    free(times);
+}
+
+struct last_access {
+    uint32_t time;
+    uint32_t slot;
+};
+
+static int compare_times(const void *a, const void *b)
+{
+    uint32_t x = ((const struct last_access *)a)->time, y = ((const struct last_access *)b)->time;
+    return x < y ? -1 : x > y;
+}
+
+// Number the last access times of the lines 0, 1, ... in order, and size
+// the tree to twice the number of lines
+static void renumber(struct reuse *r)
+{
+    struct last_access *order = malloc((r->lines + 1) * sizeof(struct last_access));
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < r->hash_size; i++)
+        if (r->keys[i] != EMPTY)
+            order[n++] = (struct last_access){r->times[i], i};
+    qsort(order, n, sizeof(struct last_access), compare_times);
+    for (uint32_t t = 0; t < n; t++)
+        r->times[order[t].slot] = t;
+    free(order);
+
+    r->capacity = 2 * (n > 512 ? n : 512);
+    free(r->tree);
+    r->tree = calloc(r->capacity + 1, sizeof(uint32_t));
+    // all of [0, n) is marked: build in linear time
+    for (uint32_t i = 1; i <= r->capacity; i++) {
+        r->tree[i] += i <= n;
+        uint32_t parent = i + (i & -i);
+        if (parent <= r->capacity)
+            r->tree[parent] += r->tree[i];
+    }
+    r->now = n;
+}
+
+struct reuse *reuse_create(int line_size)
+{
+    struct reuse *r = calloc(1, sizeof(struct reuse));
+    while ((1 << r->line_shift) < line_size)
+        r->line_shift++;
+    r->hash_size = 1024;
+    r->keys = malloc(r->hash_size * sizeof(uint32_t));
+    r->times = malloc(r->hash_size * sizeof(uint32_t));
+    memset(r->keys, 0xff, r->hash_size * sizeof(uint32_t));
+    renumber(r);
+    return r;
+}
+
+void reuse_access(struct reuse *r, uint32_t addr)
+{
+    uint32_t line = addr >> r->line_shift;
+    if (r->now == r->capacity)
+        renumber(r);
+    r->accesses++;
+    uint32_t *key = slot(r, line);
+    uint32_t *time = &r->times[key - r->keys];
+    if (*key == EMPTY) {
+        *key = line;
+        r->lines++;
+    } else {
+        // every marked time is before now, so the lines accessed since
+        // are the marked times after the line's own
+        uint32_t distance = r->lines - tree_sum(r, *time + 1);
+        if (distance >= r->hist_size) {
+            uint32_t size = r->hist_size ? 2 * r->hist_size : 1024;
+            while (size <= distance)
+                size *= 2;
+            r->hist = realloc(r->hist, size * sizeof(uint64_t));
+            memset(r->hist + r->hist_size, 0, (size - r->hist_size) * sizeof(uint64_t));
+            r->hist_size = size;
+        }
+        r->hist[distance]++;
+        tree_add(r, *time, -1);
+    }
+    *time = r->now;
+    tree_add(r, r->now++, 1);
+    if (2 * r->lines > r->hash_size)
+        grow_hash(r);
+}
+
+int reuse_write(struct reuse *r, const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return -1;
+    uint64_t reused = 0;
+    for (uint32_t d = 0; d < r->hist_size; d++)
+        reused += r->hist[d];
+    fprintf(f, "# %llu accesses to %u distinct lines of %d bytes, %llu cold misses\n",
+            (unsigned long long)r->accesses, r->lines, 1 << r->line_shift,
+            (unsigned long long)(r->accesses - reused));
+    fprintf(f, "lines,bytes,misses,miss_ratio\n");
+    // a cache of c lines misses the cold accesses and those at distance >= c
+    uint64_t misses = r->accesses;
+    for (uint32_t c = 1; c <= r->lines; c++) {
+        uint64_t hits = c - 1 < r->hist_size ? r->hist[c - 1] : 0;
+        misses -= hits;
+        if (hits || c == 1 || c == r->lines)
+            fprintf(f, "%u,%llu,%llu,%.6f\n", c, (unsigned long long)c << r->line_shift,
+                    (unsigned long long)misses, r->accesses ? (double)misses / r->accesses : 0.0);
+    }
+    return fclose(f) ? -1 : 0;
+}
+
+void reuse_delete(struct reuse *r)
+{
+    free(r->keys);
+    free(r->times);
+    free(r->tree);
+    free(r->hist);
+    free(r);
+}
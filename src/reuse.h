@@ -0,0 +1,32 @@
+#ifndef __REUSE_H__
+#define __REUSE_H__
+
+#include <stdint.h>
+
+// Reuse (LRU stack) distance analysis of the load/store stream. The distance
+// of an access is the number of distinct cache lines accessed since the
+// previous access to its line, so a fully associative LRU cache of C lines
+// misses exactly the first accesses to every line and the accesses with a
+// distance of C or more. One run gives the miss ratio of every cache size.
+//
+// The last access time of every line is kept in a hash table, and a Fenwick
+// tree over the times marks the times that are some line's last access, so
+// a distance is a prefix sum: O(log n) per access. Times are renumbered when
+// the tree is full, so memory stays proportional to the lines touched.
+// The reference interpreter feeds it, so an analysed run uses ENGINE_SWITCH.
+
+struct reuse;
+
+// line_size is a power of two
+struct reuse *reuse_create(int line_size);
+
+void reuse_access(struct reuse *r, uint32_t addr);
+
+// Write the miss ratio curve as CSV: the misses and miss ratio of a fully
+// associative LRU cache of every size, one line per size where the misses
+// change, and the largest size. Returns 0 on success.
+int reuse_write(struct reuse *r, const char *path);
+
+void reuse_delete(struct reuse *r);
+
+#endif
@@ -1,11 +1,25 @@
 # include "disassemble.h"
+# include "decode.h"
 # include "simulate.h"
 # include "memory.h"
+# include "phaseprof.h"
+# include "statstream.h"
+# include "missprofile.h"
+# include "predict.h"
+# include "block.h"
+# include "callgraph.h"
+# include "lineprof.h"
+# include "dintrace.h"
+# include "reuse.h"
+# include "pageheat.h"
 # include <stdio.h>
 # include <stdint.h>
 # include <stddef.h>
+# include <stdlib.h>
 # include <string.h>
 # include <stdarg.h>
+# include <limits.h>
+# include <setjmp.h>
 
 // Helper functions for logging events
 static inline void log_reg_write(FILE *log, int rd, uint32_t value){
@@ -15,6 +29,7 @@ static inline void log_reg_write(FILE *log, int rd, uint32_t value){
         return;
     }
 
+    SET_PHASE(PHASE_LOGGING);
     if (rd != 0){
         fprintf(log, " Register write: x%d = 0x%08X\n", rd, value);
     } else {
@@ -25,52 +40,11 @@ static inline void log_reg_write(FILE *log, int rd, uint32_t value){
 static inline void log_mem_write(FILE *log, uint32_t addr, uint32_t value){
     // Log memory writes
     if (log){
+        SET_PHASE(PHASE_LOGGING);
         fprintf(log, " Memory write: MEM[0x%08X] = 0x%08X\n", addr, value);
     }
 }
 
-// Sign-extend helpers
-static inline int32_t sign_extend(uint32_t v, int bits){
-    // Extend n-bit value to 32-bit signed integer
-    uint32_t m = 1u << (bits - 1);
-    int32_t result = (int32_t)v;
-    if (v & m){
-        result -= (int32_t)(2 * m);  // Subtracting 2*m to get negative value
-    }
-    return result;
-}
-
-// Immediate extraction helpers
-static inline int32_t imm_I(uint32_t instruct){ // I-type
-    return sign_extend(instruct >> 20, 12);
-}
-
-static inline int32_t imm_S(uint32_t instruct){ // S-type
-    uint32_t imm = ((instruct >> 25) << 5) | ((instruct >> 7) & 0x1f);
-    return sign_extend(imm, 12); // 12 bits including sign bit
-}
-
-static inline int32_t imm_B(uint32_t instruct){ // B-type
-    uint32_t imm = ((instruct >> 31) & 0x1) << 12;
-    imm |= (((instruct >> 25) & 0x3f) << 5);
-    imm |= (((instruct >> 8) & 0xf) << 1);
-    imm |= (((instruct >> 7) & 0x1) << 11);
-    return sign_extend(imm, 13); // 13 bits including sign bit
-}
-
-static inline int32_t imm_U(uint32_t instruct){ // U-type
-    return (int32_t)(instruct & 0xfffff000u);
-}
-
-static inline int32_t imm_J(uint32_t instruct){ // J-type
-    uint32_t imm = 0;
-    imm |= (((instruct >> 31) & 0x1) << 20);
-    imm |= (((instruct >> 21) & 0x3ff) << 1);
-    imm |= (((instruct >> 20) & 0x1) << 11);
-    imm |= (((instruct >> 12) & 0xff) << 12);
-    return sign_extend(imm, 21); // 21 bits including sign bit
-}
-
 // Formated logging helper
 static void log_fmt(FILE *log, const char *format, ...){
     if (!log) return;
@@ -119,70 +93,428 @@ static uint32_t rem_u(uint32_t a, uint32_t b){
 }
 
 
-#define BIMODAL_LEVELS 4
-#define BIMODAL_MAX 16384
+// Environment calls, returns 1 if the program stops
+static int do_ecall(uint32_t *R, uint32_t pc){
+    uint32_t a7 = R[17];
+    if (a7 == 1) {  // getchar -> A0
+        int c = getchar();
+        if (c == EOF){
+            c = -1;
+        }
+        R[10] = (uint32_t)c;
+    } else if (a7 == 2){ // putchar(A0)
+        putchar(R[10] & 0xff);
+        fflush(stdout);
+    } else if (a7 == 3 || a7 == 93){
+        return 1;
+    } else {
+        // Unknown ecall
+        fprintf(stderr, "Unhandled ecall %u at 0x%08x\n", a7, pc);
+        return 1;
+    }
+    return 0;
+}
+
+// Periodic reports (statistics stream, misprediction profile)
+struct ticks {
+    struct statstream *stream;
+    long stream_interval;
+    long next_snapshot;
+    struct missprofile *miss_profile;
+    long miss_interval;
+    long next_miss;
+    long next_tick;     // next instruction count where one of the reports is due
+};
+
+// insns is the instruction count the engine starts at
+static void ticks_init(struct ticks *t, const struct sim_options *opts, long insns){
+    t->stream = opts ? opts->stream : NULL;
+    t->stream_interval = t->stream ? opts->stream_interval : 0;
+    t->next_snapshot = t->stream ? (insns / t->stream_interval + 1) * t->stream_interval : LONG_MAX;
+    t->miss_profile = opts ? opts->miss_profile : NULL;
+    t->miss_interval = t->miss_profile ? opts->miss_interval : 0;
+    t->next_miss = t->miss_profile ? (insns / t->miss_interval + 1) * t->miss_interval : LONG_MAX;
+    t->next_tick = t->next_snapshot < t->next_miss ? t->next_snapshot : t->next_miss;
+}
+
+// called when stats->insns reaches t->next_tick
+static void ticks_report(struct ticks *t, const struct Stat *stats){
+    if (stats->insns == t->next_snapshot) {
+        statstream_publish(t->stream, stats);
+        t->next_snapshot += t->stream_interval;
+    }
+    if (stats->insns == t->next_miss) {
+        missprofile_record(t->miss_profile, stats);
+        t->next_miss += t->miss_interval;
+    }
+    t->next_tick = t->next_snapshot < t->next_miss ? t->next_snapshot : t->next_miss;
+}
+
+// Why an engine stopped (the stop flag of the engines)
+enum {
+    STOP_NONE,
+    STOP_EXIT,          // the program ended, or the check hook asked to stop
+    STOP_BREAKPOINT,    // before the instruction at a breakpoint
+    STOP_WATCHPOINT,    // after a store to a watched range
+    STOP_STEP,          // after the instruction of a single step
+};
+
+// Hand the architectural state to the check hook
+static void call_check(sim_check_fn check, void *check_ctx, int *stop,
+                       const uint32_t *R, uint32_t pc, long instr_count){
+    struct cpu_state state;
+    memcpy(state.R, R, sizeof(state.R));
+    state.pc = pc;
+    state.insns = instr_count;
+    if (check(check_ctx, &state))
+        *stop = STOP_EXIT;
+}
 
-static uint8_t bimodal[BIMODAL_LEVELS][BIMODAL_MAX];
-static int bimodal_sizes[BIMODAL_LEVELS] = {256, 1024, 4096, 16384};
+const char *sim_engine_names[NUM_ENGINES] = {
+    "switch",
+    "predecode",
+    "fused",
+    "block",
+};
+
+// A run of the engines. They start from cpu and leave their final state in
+// it. A misaligned access under MISALIGN_TRAP (see memory.h), or a fetch
+// from a misaligned pc, longjmps back out of the engine; cpu and stats then
+// hold the state before the faulting instruction. Only the reference
+// interpreter traps on loads and stores, it keeps pc and count in cpu at the
+// start of every instruction and its registers in live_R for the trap
+// handler. The other engines write their state back before a misaligned
+// fetch, which only happens between blocks.
+struct sim_session {
+    struct memory *mem;
+    struct cpu_state cpu;
+    int stop;
+    int single_step;    // run one instruction on the reference interpreter
+    FILE *log_file;     // logging, always on the reference interpreter
+    struct symbols *symbols;
+    const struct sim_options *opts;
+    struct Stat *stats;
+    struct Stat stats_buf;
+    long misaligned;    // memory counters at the start
+    long code_writes;
+    struct decode_cache *dc;    // predecoded engines
+    struct block_cache *bc;     // ENGINE_BLOCK
+    // breakpoints checked by the reference interpreter, the other engines
+    // find them in the decode cache
+    const uint32_t *breakpoints;
+    int num_breakpoints;
+    jmp_buf trap;
+    const uint32_t *live_R;     // registers of the reference interpreter
+    int trap_addr;
+    int trap_size;
+    enum memory_access trap_access;
+    int watch_addr;     // the store that hit a watchpoint
+    int watch_size;
+};
+
+static void run_switch(struct sim_session *run);
+static void run_predecoded(struct sim_session *run);
+static void run_blocks(struct sim_session *run);
+
+static void misaligned_trap(void *ctx, int addr, int size, enum memory_access access){
+    struct sim_session *run = ctx;
+    if (run->live_R)
+        memcpy(run->cpu.R, run->live_R, sizeof(run->cpu.R));
+    run->trap_addr = addr;
+    run->trap_size = size;
+    run->trap_access = access;
+    longjmp(run->trap, 1);
+}
 
-#define GSHARE_MAX 16384
+// A store went to code that has been decoded
+static void code_written(void *ctx, uint32_t addr, uint32_t size){
+    struct sim_session *run = ctx;
+    if (run->bc)
+        block_cache_invalidate(run->bc, addr, size);
+    else if (run->dc)
+        decode_cache_invalidate(run->dc, addr, size);
+}
 
-static uint8_t gshare[BIMODAL_LEVELS][GSHARE_MAX];
-static uint32_t ghr[BIMODAL_LEVELS];
+// A store to a watched range. The engine stops right after the store, in
+// the middle of a block or superinstruction if need be.
+static void watch_hit(void *ctx, int addr, int size){
+    struct sim_session *run = ctx;
+    if (run->stop == STOP_NONE) {
+        run->stop = STOP_WATCHPOINT;
+        run->watch_addr = addr;
+        run->watch_size = size;
+    }
+}
+
+// The predecoded engines fetch from a misaligned pc only between blocks and
+// instructions, write their state back for the trap handler first
+static void misaligned_fetch(struct sim_session *run, const uint32_t *R, uint32_t pc, long insns,
+                             long fused){
+    memcpy(run->cpu.R, R, sizeof(run->cpu.R));
+    run->cpu.pc = pc;
+    run->cpu.insns = insns;
+    run->stats->insns = insns;
+    run->stats->fused_insns = fused;
+    memory_misaligned_fetch(run->mem, (int)pc);
+}
+
+// Kept apart from the callers so no locals live across setjmp
+static int run_engine(struct sim_session *run){
+    if (setjmp(run->trap))
+        return 1;
+    run->stop = STOP_NONE;
+    run->live_R = NULL;
+    if (run->single_step || run->log_file)
+        run_switch(run);
+    else if (run->bc)
+        run_blocks(run);
+    else if (run->dc)
+        run_predecoded(run);
+    else
+        run_switch(run);
+    return 0;
+}
+
+struct sim_session *sim_session_create(struct memory *mem, int start_addr, FILE *log_file,
+                                       struct symbols *symbols, const struct sim_options *opts){
+    enum sim_engine engine = opts ? opts->engine : ENGINE_SWITCH;
+    struct sim_session *run = calloc(1, sizeof(struct sim_session));
+    run->mem = mem;
+    run->cpu.pc = (uint32_t)start_addr;
+    run->log_file = log_file;
+    run->symbols = symbols;
+    run->opts = opts;
+    run->stats = &run->stats_buf;
+    predict_init(run->stats);
+    run->misaligned = memory_misaligned_count(mem);
+    run->code_writes = memory_code_writes(mem);
+
+    // The logging output is produced per instruction, and the shadow call
+    // stack of the call-graph profile, the execution profile and the address
+    // trace maintained, by the reference interpreter only, which is also the
+    // one that keeps the state at a trapping load or store
+    int reference = log_file || (opts && (opts->callgraph || opts->lineprof || opts->din_trace
+                                      || opts->reuse || opts->page_heat))
+                    || memory_misalign_policy(mem) == MISALIGN_TRAP;
+    if (engine == ENGINE_BLOCK && !reference)
+        run->bc = block_cache_create(mem);
+    else if (engine != ENGINE_SWITCH && !reference)
+        run->dc = decode_cache_create(mem, engine == ENGINE_FUSED);
+    struct decode_cache *dc = run->bc ? run->bc->dc : run->dc;
+    for (int i = 0; dc && opts && i < opts->num_predecode; i++)
+        decode_cache_prefill(dc, opts->predecode[i].start, opts->predecode[i].end);
+
+    memory_set_trap_handler(mem, misaligned_trap, run);
+    memory_set_code_handler(mem, code_written, run);
+    memory_set_watch_handler(mem, watch_hit, run);
+    if (opts && opts->num_breakpoints)
+        sim_session_set_breakpoints(run, opts->breakpoints, opts->num_breakpoints);
+    for (int i = 0; opts && i < opts->num_watchpoints; i++)
+        memory_watch(mem, opts->watchpoints[i].addr, opts->watchpoints[i].size);
+    return run;
+}
+
+struct cpu_state *sim_session_cpu(struct sim_session *run){
+    return &run->cpu;
+}
+
+void sim_session_set_breakpoints(struct sim_session *run, const uint32_t *pcs, int num){
+    struct decode_cache *dc = run->bc ? run->bc->dc : run->dc;
+    if (dc) {
+        for (int i = 0; i < dc->num_breakpoints; i++)
+            code_written(run, dc->breakpoints[i], 4);
+        for (int i = 0; i < num; i++)
+            code_written(run, pcs[i], 4);
+        decode_cache_set_breakpoints(dc, pcs, num);
+    }
+    run->breakpoints = pcs;
+    run->num_breakpoints = num;
+}
+
+static enum sim_stop stop_reason(struct sim_session *run, int trapped){
+    if (trapped)
+        return SIM_STOP_TRAP;
+    switch (run->stop) {
+        case STOP_BREAKPOINT: return SIM_STOP_BREAKPOINT;
+        case STOP_WATCHPOINT: return SIM_STOP_WATCHPOINT;
+        case STOP_STEP: return SIM_STOP_STEP;
+    }
+    return SIM_STOP_EXIT;
+}
+
+enum sim_stop sim_session_step(struct sim_session *run){
+    run->single_step = 1;
+    int trapped = run_engine(run);
+    run->single_step = 0;
+    return stop_reason(run, trapped);
+}
+
+enum sim_stop sim_session_continue(struct sim_session *run){
+    // step off a breakpoint at the current pc first
+    for (int i = 0; i < run->num_breakpoints; i++) {
+        if (run->breakpoints[i] == run->cpu.pc) {
+            enum sim_stop stop = sim_session_step(run);
+            if (stop != SIM_STOP_STEP)
+                return stop;
+            break;
+        }
+    }
+    return stop_reason(run, run_engine(run));
+}
+
+uint32_t sim_session_watch_addr(struct sim_session *run){
+    return (uint32_t)run->watch_addr;
+}
+
+struct Stat sim_session_finish(struct sim_session *run){
+    struct memory *mem = run->mem;
+    const struct sim_options *opts = run->opts;
+    memory_set_trap_handler(mem, NULL, NULL);
+    memory_set_code_handler(mem, NULL, NULL);
+    memory_set_watch_handler(mem, NULL, NULL);
+    for (int i = 0; opts && i < opts->num_watchpoints; i++)
+        memory_unwatch(mem, opts->watchpoints[i].addr, opts->watchpoints[i].size);
+    SET_PHASE(PHASE_OUTSIDE);
+
+    struct Stat stats = *run->stats;
+    stats.misaligned = memory_misaligned_count(mem) - run->misaligned;
+    stats.code_writes = memory_code_writes(mem) - run->code_writes;
+    if (run->bc) {
+        stats.traces = run->bc->num_traces;
+        block_cache_delete(run->bc);
+    }
+    if (run->dc)
+        decode_cache_delete(run->dc);
+    free(run);
+    return stats;
+}
+
+// Registers and position at a breakpoint or watchpoint
+static void dump_state(FILE *f, const struct cpu_state *cpu, struct symbols *symbols){
+    const char *sym = symbols_value_to_sym(symbols, cpu->pc);
+    fprintf(f, "pc 0x%08x%s%s%s after %ld instructions\n", cpu->pc,
+            sym ? " <" : "", sym ? sym : "", sym ? ">" : "", cpu->insns);
+    for (int r = 0; r < 32; r++)
+        fprintf(f, "x%-2d 0x%08x%s", r, cpu->R[r], r % 4 == 3 ? "\n" : "   ");
+}
 
 //  RISC-V simulator
 struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file, 
-                    struct symbols* symbols){
+                    struct symbols* symbols, const struct sim_options *opts){
+
+    // With BREAK_TRACE logging starts at the first breakpoint or watchpoint,
+    // and the fast engines run up to it
+    FILE *deferred_log = NULL;
+    if (log_file && opts && (opts->num_breakpoints || opts->num_watchpoints) &&
+        opts->on_break == BREAK_TRACE) {
+        deferred_log = log_file;
+        log_file = NULL;
+    }
 
     // Initialize logging
     if (log_file) {
         fprintf(log_file, "Simulator logging enabled\n");
         fflush(log_file);
-    } else {
+    } else if (!deferred_log) {
         fprintf(stderr, "Simulator logging disabled\n");
     }
-    
-     // Initialize registers and PC
-    uint32_t R[32];
-    memset(R, 0, sizeof(R));
-    uint32_t PC = (uint32_t)start_addr;
-    long instr_count = 0;
-    struct Stat stats;
-    stats.insns = 0;
 
-    stats.nt_predictions = 0;
-    stats.nt_mispredictions = 0;
-
-    stats.btfnt_predictions = 0;
-    stats.btfnt_mispredictions = 0;
-
-    for (int i = 0; i < BIMODAL_LEVELS; i++) {
-        for (int j = 0; j < bimodal_sizes[i]; j++) {
-            bimodal[i][j] = 1;
+    struct sim_session *run = sim_session_create(mem, start_addr, log_file, symbols, opts);
+    enum sim_stop stop = sim_session_continue(run);
+    if (stop == SIM_STOP_BREAKPOINT || stop == SIM_STOP_WATCHPOINT) {
+        if (stop == SIM_STOP_BREAKPOINT)
+            fprintf(stderr, "Breakpoint hit\n");
+        else
+            fprintf(stderr, "Watchpoint hit: write of %d bytes to 0x%08x\n",
+                    run->watch_size, (uint32_t)run->watch_addr);
+        dump_state(stderr, &run->cpu, symbols);
+        if (deferred_log) {
+            // log the rest of the run on the reference interpreter
+            memory_set_watch_handler(mem, NULL, NULL);
+            sim_session_set_breakpoints(run, NULL, 0);
+            run->log_file = deferred_log;
+            fprintf(deferred_log, "Simulator logging enabled\n");
+            fflush(deferred_log);
+            stop = stop_reason(run, run_engine(run));
         }
-        stats.bimodal_predictions[i] = 0;
-        stats.bimodal_mispredictions[i] = 0;
     }
-
-    for (int i = 0; i < BIMODAL_LEVELS; i++) {
-        for (int j = 0; j < bimodal_sizes[i]; j++) {
-            gshare[i][j] = 1;  // weakly not taken
-        }
-        ghr[i] = 0;
-        stats.gshare_predictions[i] = 0;
-        stats.gshare_mispredictions[i] = 0;
+    if (stop == SIM_STOP_TRAP) {
+        static const char *access_names[] = {"read", "write", "fetch"};
+        fprintf(stderr, "Misaligned %s of %d bytes at 0x%08x, simulation stopped\n",
+                access_names[run->trap_access], run->trap_size, (uint32_t)run->trap_addr);
+        dump_state(stderr, &run->cpu, symbols);
     }
+    return sim_session_finish(run);
+}
+
+// Reference interpreter -------------------------------------------------------
+//
+// Decodes every instruction as it is fetched, and is the only engine that
+// can log
+
+// ra and t0 are the link registers of the calling convention
+static inline int is_link(uint32_t r){
+    return r == 1 || r == 5;
+}
+
+static void run_switch(struct sim_session *run){
+    struct memory *mem = run->mem;
+    struct Stat *stats = run->stats;
+    FILE *log_file = run->log_file;
+    struct symbols *symbols = run->symbols;
+    sim_check_fn check = run->opts ? run->opts->check : NULL;
+    void *check_ctx = run->opts ? run->opts->check_ctx : NULL;
+    struct callgraph *callgraph = run->opts ? run->opts->callgraph : NULL;
+    struct lineprof *lineprof = run->opts ? run->opts->lineprof : NULL;
+    struct dintrace *din = run->opts ? run->opts->din_trace : NULL;
+    struct reuse *reuse = run->opts ? run->opts->reuse : NULL;
+    struct pageheat *heat = run->opts ? run->opts->page_heat : NULL;
+    struct ticks ticks;
+    ticks_init(&ticks, run->opts, run->cpu.insns);
+
+     // Initialize registers and PC
+    uint32_t R[32];
+    memcpy(R, run->cpu.R, sizeof(R));
+    uint32_t PC = run->cpu.pc;
+    long instr_count = run->cpu.insns;
+    run->live_R = R;
 
     // Buffer for disassembly when logging
     char disassem_buf[256];
     
-    int stop = 0;
-    while(!stop){
+    int *stop = &run->stop;
+    while(!*stop){
+        if (run->num_breakpoints && !run->single_step) {
+            int i = 0;
+            while (i < run->num_breakpoints && run->breakpoints[i] != PC)
+                i++;
+            if (i < run->num_breakpoints) {
+                *stop = STOP_BREAKPOINT;
+                break;
+            }
+        }
+        // the state before the instruction, for a trap in the middle of it
+        run->cpu.pc = PC;
+        run->cpu.insns = instr_count;
+        SET_PHASE(PHASE_FETCH);
+        if (PC & 3)
+            memory_misaligned_fetch(mem, (int)PC);
         uint32_t instruction = memory_rd_w(mem, PC);    // fetch
         uint32_t current_pc = PC;
         instr_count++;
+        if (lineprof)
+            lineprof_insn(lineprof, current_pc);
+        if (din) {
+            dintrace_insn(din, instr_count);
+            dintrace_access(din, DIN_FETCH, current_pc);
+        }
+        if (heat) {
+            pageheat_insn(heat, instr_count);
+            pageheat_access(heat, HEAT_FETCH, current_pc);
+        }
 
         // Decodeing standard RISC-V fields
+        SET_PHASE(PHASE_DECODE);
         uint32_t opcode = instruction & 0x7f;
         uint32_t rd = (instruction >> 7) & 0x1f;
         uint32_t funct3 = (instruction >> 12) & 0x7;
@@ -195,8 +527,10 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
 
         // Preparing disassembly string if logging
         if (log_file && symbols){
+            SET_PHASE(PHASE_LOGGING);
             disassemble(current_pc, instruction, disassem_buf, sizeof(disassem_buf), symbols);
         } else if (log_file){
+            SET_PHASE(PHASE_LOGGING);
             disassemble(current_pc, instruction, disassem_buf, sizeof(disassem_buf), NULL);
         } else {
             disassem_buf[0] = '\0';
@@ -206,6 +540,7 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
         switch (opcode){
             // R-type
             case 0x33: {
+                SET_PHASE(funct7 == 0x01 ? PHASE_EXEC_MULDIV : PHASE_EXEC_ALU);
                 if (funct7 == 0x01) {
                     switch (funct3) {
 
@@ -343,6 +678,7 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
 
             // I - type
             case 0x13: {
+                SET_PHASE(PHASE_EXEC_ALU);
                 int32_t imm = imm_I(instruction);
                 switch(funct3){
                     case 0x0: { // addi
@@ -411,8 +747,15 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
 
             // Loads
             case 0x03: {
+                SET_PHASE(PHASE_EXEC_LOAD);
                 int32_t imm = imm_I(instruction);
                 uint32_t addr = (uint32_t)((int32_t)R[rs1] + imm);
+                if (din && (funct3 <= 0x2 || funct3 == 0x4 || funct3 == 0x5))
+                    dintrace_access(din, DIN_READ, addr);
+                if (reuse && (funct3 <= 0x2 || funct3 == 0x4 || funct3 == 0x5))
+                    reuse_access(reuse, addr);
+                if (heat && (funct3 <= 0x2 || funct3 == 0x4 || funct3 == 0x5))
+                    pageheat_access(heat, HEAT_READ, addr);
                 switch(funct3) {
                     case 0x0: { // lb
                         int32_t val = (int8_t)memory_rd_b(mem, addr);
@@ -452,8 +795,15 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
 
             // Stores
             case 0x23: {
+                SET_PHASE(PHASE_EXEC_STORE);
                 int32_t imm = imm_S(instruction);
                 uint32_t addr = (uint32_t)((int32_t)R[rs1] + imm);
+                if (din && funct3 <= 0x2)
+                    dintrace_access(din, DIN_WRITE, addr);
+                if (reuse && funct3 <= 0x2)
+                    reuse_access(reuse, addr);
+                if (heat && funct3 <= 0x2)
+                    pageheat_access(heat, HEAT_WRITE, addr);
                 switch (funct3){
                     case 0x0: { // sb
                         uint32_t value = R[rs2] & 0xFF;
@@ -481,6 +831,7 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
 
             // Branches 
             case 0x63: {
+                SET_PHASE(PHASE_EXEC_BRANCH);
                 int32_t imm = imm_B(instruction);
                 uint32_t target = (uint32_t)((int32_t)current_pc + imm);
                 int take = 0;
@@ -499,70 +850,46 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
                     branch_taken = 1;
                 }
 
-                stats.nt_predictions++;
-                if (take)
-                    stats.nt_mispredictions++;
-
-                stats.btfnt_predictions++;
-                int btfnt_pred_taken = (target < current_pc);
-                if (btfnt_pred_taken != take)
-                    stats.btfnt_mispredictions++;
-
-                for (int i = 0; i < BIMODAL_LEVELS; i++) {
-                    int size = bimodal_sizes[i];
-                    int index = (current_pc >> 2) & (size - 1);
-
-                    int pred = (bimodal[i][index] >= 2);
-                    stats.bimodal_predictions[i]++;
-
-                    if (pred != take)
-                        stats.bimodal_mispredictions[i]++;
-
-                    if (take && bimodal[i][index] < 3) bimodal[i][index]++;
-                    if (!take && bimodal[i][index] > 0) bimodal[i][index]--;
-                }
-
-                for (int i = 0; i < BIMODAL_LEVELS; i++) {
-                    int size = bimodal_sizes[i];
-                    int index = ((current_pc >> 2) ^ ghr[i]) & (size - 1);
-
-                    int pred = (gshare[i][index] >= 2);
-                    stats.gshare_predictions[i]++;
-
-                    if (pred != take)
-                        stats.gshare_mispredictions[i]++;
-
-                    if (take && gshare[i][index] < 3) gshare[i][index]++;
-                    if (!take && gshare[i][index] > 0) gshare[i][index]--;
-
-                    ghr[i] = ((ghr[i] << 1) | (take ? 1 : 0)) & (size - 1);
-                }
+                SET_PHASE(PHASE_PREDICTOR);
+                long missed = stats->gshare_mispredictions[3];
+                predict_branch(stats, current_pc, target, take);
+                if (lineprof)
+                    lineprof_branch(lineprof, current_pc, stats->gshare_mispredictions[3] != missed);
 
                 break;
             }
 
             // jal
             case 0x6f: {
+                SET_PHASE(PHASE_EXEC_JUMP);
                 int32_t imm = imm_J(instruction);
                 uint32_t target = (uint32_t)((int32_t)current_pc + imm);
                 R[rd] = current_pc + 4;
                 log_reg_write(log_file, rd, R[rd]);
                 next_pc = target;
+                if (callgraph && is_link(rd))
+                    callgraph_call(callgraph, target, current_pc + 4, instr_count, stats);
                 break;
             }
 
             // jalr
             case 0x67: {
+                SET_PHASE(PHASE_EXEC_JUMP);
                 int32_t imm = imm_I(instruction);
                 uint32_t t = (uint32_t)(((int32_t)R[rs1] + imm) & ~1u);
                 R[rd] = current_pc + 4;
                 log_reg_write(log_file, rd, R[rd]);
                 next_pc = t;
+                if (callgraph && is_link(rd))
+                    callgraph_call(callgraph, t, current_pc + 4, instr_count, stats);
+                else if (callgraph && rd == 0 && is_link(rs1))
+                    callgraph_return(callgraph, t, instr_count, stats);
                 break;
             }
 
             // lui
             case 0x37: {
+                SET_PHASE(PHASE_EXEC_UPPER);
                 int32_t imm = imm_U(instruction);
                 R[rd] = (uint32_t)imm;
                 log_reg_write(log_file, rd, R[rd]);
@@ -571,6 +898,7 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
 
              // auipc
             case 0x17: {
+                SET_PHASE(PHASE_EXEC_UPPER);
                 int32_t imm = imm_U(instruction);
                 R[rd] = (uint32_t)((int32_t)current_pc + imm);
                 log_reg_write(log_file, rd, R[rd]);
@@ -579,24 +907,9 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
 
             // System: ecall
             case 0x73: {
+                SET_PHASE(PHASE_ECALL);
                 if (instruction == 0x00000073){
-                    uint32_t a7 = R[17];
-                    if (a7 == 1) {  // getchar -> A0
-                        int c = getchar();
-                        if (c == EOF){
-                            c = -1;
-                        }
-                        R[10] = (uint32_t)c;
-                    } else if (a7 == 2){ // putchar(A0)
-                        putchar(R[10] & 0xff);
-                        fflush(stdout);
-                    } else if (a7 == 3 || a7 == 93){
-                        stop = 1;
-                    } else {
-                        // Unknown ecall
-                        fprintf(stderr, "Unhandled ecall %u at 0x%08x\n", a7, current_pc);
-                        stop = 1;
-                    }
+                    *stop = do_ecall(R, current_pc);
                 } else {
                     // Other system instructions not implemented
                     fprintf(stderr, "Uhandled system instruction 0x%08x at PC=0x%08x\n", instruction, current_pc);
@@ -606,7 +919,7 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
 
             default:
                 fprintf(stderr, "Unknown opcode: 0x%08x at 0x%08x\n", instruction, current_pc);
-                stop = 1;
+                *stop = STOP_EXIT;
                 break;
         }
 
@@ -615,6 +928,7 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
 
         // Logging per-instruction
         if(log_file){
+            SET_PHASE(PHASE_LOGGING);
             // Print instruction count, address, raw instruction, disassembler
             log_fmt(log_file, "%6ld => %08x : %08x    %s", instr_count, current_pc, instruction, disassem_buf);
             if (branch_taken) {
@@ -627,11 +941,459 @@ struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file,
         // Advance PC to next instruction
         PC = next_pc;
 
+        if (check)
+            call_check(check, check_ctx, stop, R, PC, instr_count);
+
         // Save instr_count in stats periodically
-        stats.insns = instr_count;
+        stats->insns = instr_count;
+        if (instr_count == ticks.next_tick)
+            ticks_report(&ticks, stats);
+        if (run->single_step && !*stop)
+            *stop = STOP_STEP;
     }
 
-    stats.insns = instr_count;
-    return stats;
+    stats->insns = instr_count;
+    memcpy(run->cpu.R, R, sizeof(R));
+    run->cpu.pc = PC;
+    run->cpu.insns = instr_count;
+}
+
+// Predecoded engines --------------------------------------------------------
+//
+// Execute instructions from the decode cache instead of decoding every fetch.
+// With fuse set, common pairs of instructions are executed as one
+// superinstruction (see fuse_insns); the results and instruction counts are
+// exactly those of the reference interpreter.
+
+static inline uint32_t alu(int op, uint32_t a, uint32_t b){
+    switch (op) {
+        case OP_ADD: case OP_ADDI: return a + b;
+        case OP_SUB: return a - b;
+        case OP_SLL: return a << (b & 0x1f);
+        case OP_SLLI: return a << b;
+        case OP_SLT: case OP_SLTI: return (int32_t)a < (int32_t)b;
+        case OP_SLTU: case OP_SLTIU: return a < b;
+        case OP_XOR: case OP_XORI: return a ^ b;
+        case OP_SRL: return a >> (b & 0x1f);
+        case OP_SRLI: return a >> b;
+        case OP_SRA: return (uint32_t)((int32_t)a >> (b & 0x1f));
+        case OP_SRAI: return (uint32_t)((int32_t)a >> b);
+        case OP_OR: case OP_ORI: return a | b;
+        case OP_AND: case OP_ANDI: return a & b;
+    }
+    return 0;
+}
+
+static inline int branch_taken(int op, uint32_t a, uint32_t b){
+    switch (op) {
+        case OP_BEQ: return a == b;
+        case OP_BNE: return a != b;
+        case OP_BLT: return (int32_t)a < (int32_t)b;
+        case OP_BGE: return (int32_t)a >= (int32_t)b;
+        case OP_BLTU: return a < b;
+        case OP_BGEU: return a >= b;
+    }
+    return 0;   // OP_BNEVER
+}
+
+// second operand of an ALU op: rs2 for register ops, the immediate otherwise
+#define ALU_B(d) ((d)->op1 >= OP_ADDI ? (uint32_t)(d)->imm : R[(d)->rs2])
+
+// Branch at pc with the given outcome, updates the predictors and returns the
+// next pc
+static inline uint32_t branch(struct Stat *stats, uint32_t pc, int32_t imm, int take){
+    uint32_t target = pc + (uint32_t)imm;
+    predict_branch(stats, pc, target, take);
+    return take ? target : pc + 4;
+}
+
+// Execute the predecoded instruction d at pc as op (d->op, or d->op1 to run
+// only the first half of a superinstruction). Sets *next_pc for control
+// transfers and *stop when the program ends or at a breakpoint. Returns the
+// number of guest instructions executed.
+static inline __attribute__((always_inline))
+int exec_insn(struct memory *mem, uint32_t *R, struct Stat *stats, const struct decoded_insn *d,
+              int op, uint32_t pc, uint32_t *next_pc, int *stop){
+    switch (op) {
+        case OP_ADD: R[d->rd] = R[d->rs1] + R[d->rs2]; break;
+        case OP_SUB: R[d->rd] = R[d->rs1] - R[d->rs2]; break;
+        case OP_SLL: R[d->rd] = R[d->rs1] << (R[d->rs2] & 0x1f); break;
+        case OP_SLT: R[d->rd] = (int32_t)R[d->rs1] < (int32_t)R[d->rs2]; break;
+        case OP_SLTU: R[d->rd] = R[d->rs1] < R[d->rs2]; break;
+        case OP_XOR: R[d->rd] = R[d->rs1] ^ R[d->rs2]; break;
+        case OP_SRL: R[d->rd] = R[d->rs1] >> (R[d->rs2] & 0x1f); break;
+        case OP_SRA: R[d->rd] = (uint32_t)((int32_t)R[d->rs1] >> (R[d->rs2] & 0x1f)); break;
+        case OP_OR: R[d->rd] = R[d->rs1] | R[d->rs2]; break;
+        case OP_AND: R[d->rd] = R[d->rs1] & R[d->rs2]; break;
+
+        case OP_MUL:
+            R[d->rd] = (uint32_t)((int64_t)(int32_t)R[d->rs1] * (int64_t)(int32_t)R[d->rs2]);
+            break;
+        case OP_MULH:
+            R[d->rd] = (uint32_t)((uint64_t)((int64_t)(int32_t)R[d->rs1] *
+                                             (int64_t)(int32_t)R[d->rs2]) >> 32);
+            break;
+        case OP_MULHSU:
+            // fits in 64 bits: |signed 32 x unsigned 32| < 2^63
+            R[d->rd] = (uint32_t)((uint64_t)((int64_t)(int32_t)R[d->rs1] *
+                                             (int64_t)R[d->rs2]) >> 32);
+            break;
+        case OP_MULHU:
+            R[d->rd] = (uint32_t)(((uint64_t)R[d->rs1] * (uint64_t)R[d->rs2]) >> 32);
+            break;
+        case OP_DIV: R[d->rd] = (uint32_t)div_s((int32_t)R[d->rs1], (int32_t)R[d->rs2]); break;
+        case OP_DIVU: R[d->rd] = div_u(R[d->rs1], R[d->rs2]); break;
+        case OP_REM: R[d->rd] = (uint32_t)rem_s((int32_t)R[d->rs1], (int32_t)R[d->rs2]); break;
+        case OP_REMU: R[d->rd] = rem_u(R[d->rs1], R[d->rs2]); break;
+
+        case OP_ADDI: R[d->rd] = R[d->rs1] + (uint32_t)d->imm; break;
+        case OP_SLTI: R[d->rd] = (int32_t)R[d->rs1] < d->imm; break;
+        case OP_SLTIU: R[d->rd] = R[d->rs1] < (uint32_t)d->imm; break;
+        case OP_XORI: R[d->rd] = R[d->rs1] ^ (uint32_t)d->imm; break;
+        case OP_ORI: R[d->rd] = R[d->rs1] | (uint32_t)d->imm; break;
+        case OP_ANDI: R[d->rd] = R[d->rs1] & (uint32_t)d->imm; break;
+        case OP_SLLI: R[d->rd] = R[d->rs1] << d->imm; break;
+        case OP_SRLI: R[d->rd] = R[d->rs1] >> d->imm; break;
+        case OP_SRAI: R[d->rd] = (uint32_t)((int32_t)R[d->rs1] >> d->imm); break;
+
+        case OP_LB: R[d->rd] = (uint32_t)(int8_t)memory_rd_b(mem, R[d->rs1] + d->imm); break;
+        case OP_LH: R[d->rd] = (uint32_t)(int16_t)memory_rd_h(mem, R[d->rs1] + d->imm); break;
+        case OP_LW: R[d->rd] = (uint32_t)memory_rd_w(mem, R[d->rs1] + d->imm); break;
+        case OP_LBU: R[d->rd] = (uint32_t)memory_rd_b(mem, R[d->rs1] + d->imm); break;
+        case OP_LHU: R[d->rd] = (uint32_t)memory_rd_h(mem, R[d->rs1] + d->imm); break;
+
+        case OP_SB: memory_wr_b(mem, R[d->rs1] + d->imm, (int)(R[d->rs2] & 0xff)); break;
+        case OP_SH: memory_wr_h(mem, R[d->rs1] + d->imm, (int)(R[d->rs2] & 0xffff)); break;
+        case OP_SW: memory_wr_w(mem, R[d->rs1] + d->imm, (int)R[d->rs2]); break;
+
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BGE: case OP_BLTU: case OP_BGEU:
+        case OP_BNEVER:
+            *next_pc = branch(stats, pc, d->imm,
+                              branch_taken(op, R[d->rs1], R[d->rs2]));
+            break;
+
+        case OP_JAL:
+            R[d->rd] = pc + 4;
+            *next_pc = pc + d->imm;
+            break;
+        case OP_JALR:
+            *next_pc = (R[d->rs1] + d->imm) & ~1u;
+            R[d->rd] = pc + 4;
+            break;
+        case OP_LUI: R[d->rd] = (uint32_t)d->imm; break;
+        case OP_AUIPC: R[d->rd] = pc + d->imm; break;
+
+        case OP_ECALL:
+            *stop = do_ecall(R, pc);
+            break;
+        case OP_NOP:
+            break;
+        case OP_BAD_FUNCT7:
+            fprintf(stderr,"Unknown funct7: 0x%x\n", ((uint32_t)d->imm >> 25) & 0x7f);
+            break;
+        case OP_BAD_SYSTEM:
+            fprintf(stderr, "Uhandled system instruction 0x%08x at PC=0x%08x\n", (uint32_t)d->imm, pc);
+            break;
+        case OP_ILLEGAL:
+            fprintf(stderr, "Unknown opcode: 0x%08x at 0x%08x\n", (uint32_t)d->imm, pc);
+            *stop = STOP_EXIT;
+            break;
+        case OP_BREAKPOINT:
+            *stop = STOP_BREAKPOINT;
+            *next_pc = pc;
+            return 0;
+
+        // Superinstructions, the first instruction never writes x0
+        case OP_LUI_ADDI:
+            R[d->rd] = (uint32_t)d->imm + (uint32_t)d->imm2;
+            goto fused;
+        case OP_AUIPC_ADDI:
+            R[d->rd] = pc + d->imm + d->imm2;
+            goto fused;
+        case OP_AUIPC_JALR:
+            R[d->rd] = pc + d->imm;
+            *next_pc = (R[d->rs1_2] + d->imm2) & ~1u;
+            R[d->rd2] = pc + 8;
+            return 2;
+        case OP_SLLI_ADD:
+            R[d->rd] = R[d->rs1] << d->imm;
+            R[d->rd2] = R[d->rs1_2] + R[d->rs2_2];
+            goto fused;
+        case OP_ADDI_BRANCH:
+            R[d->rd] = R[d->rs1] + (uint32_t)d->imm;
+            goto fused_branch;
+        case OP_ADD_BRANCH:
+            R[d->rd] = R[d->rs1] + R[d->rs2];
+            goto fused_branch;
+        case OP_ALU_BRANCH:
+            R[d->rd] = alu(d->op1, R[d->rs1], ALU_B(d));
+            goto fused_branch;
+        case OP_LW_LW:
+            R[d->rd] = (uint32_t)memory_rd_w(mem, R[d->rs1] + d->imm);
+            R[d->rd2] = (uint32_t)memory_rd_w(mem, R[d->rs1_2] + d->imm2);
+            goto fused;
+        case OP_SW_SW: {
+            uint32_t addr = R[d->rs1] + d->imm;
+            memory_wr_w(mem, addr, (int)R[d->rs2]);
+            // a first store into the second instruction leaves it to run on
+            // its own from its new code, and a watchpoint hit stops the
+            // run right after the first store
+            if (addr - pc - 1 < 7 || *stop)
+                return 1;
+            memory_wr_w(mem, R[d->rs1_2] + d->imm2, (int)R[d->rs2_2]);
+            goto fused;
+        }
+
+        fused_branch:
+            *next_pc = branch(stats, pc + 4, d->imm2,
+                              branch_taken(d->op2, R[d->rs1_2], R[d->rs2_2]));
+            return 2;
+        fused:
+            *next_pc = pc + 8;
+            return 2;
+    }
+    return 1;
+
+}
+
+// Phase reported to the sampling profiler while executing each op
+static uint8_t op_phase[NUM_OPS];
+
+static void init_op_phase(void){
+    for (int op = 0; op < NUM_OPS; op++) {
+        int phase = PHASE_EXEC_ALU;
+        if (op >= OP_MUL && op <= OP_REMU) phase = PHASE_EXEC_MULDIV;
+        else if (op >= OP_LB && op <= OP_LHU) phase = PHASE_EXEC_LOAD;
+        else if (op >= OP_SB && op <= OP_SW) phase = PHASE_EXEC_STORE;
+        else if ((op >= OP_BEQ && op <= OP_BNEVER) || (op >= OP_ADDI_BRANCH && op <= OP_ALU_BRANCH))
+            phase = PHASE_EXEC_BRANCH;
+        else if (op == OP_JAL || op == OP_JALR || op == OP_AUIPC_JALR || op == OP_CALL || op == OP_RET)
+            phase = PHASE_EXEC_JUMP;
+        else if (op == OP_LUI || op == OP_AUIPC || op == OP_LUI_ADDI || op == OP_AUIPC_ADDI)
+            phase = PHASE_EXEC_UPPER;
+        else if (op == OP_LW_LW || op == OP_LW_SP || op == OP_LW_RA_SP) phase = PHASE_EXEC_LOAD;
+        else if (op == OP_SW_SW || op == OP_SW_SP || op == OP_SW_RA_SP) phase = PHASE_EXEC_STORE;
+        else if (op == OP_ECALL) phase = PHASE_ECALL;
+        op_phase[op] = phase;
+    }
 }
 
+static void run_predecoded(struct sim_session *run){
+    struct decode_cache *dc = run->dc;
+    struct Stat *stats = run->stats;
+    sim_check_fn check = run->opts ? run->opts->check : NULL;
+    void *check_ctx = run->opts ? run->opts->check_ctx : NULL;
+    struct ticks ticks;
+    ticks_init(&ticks, run->opts, run->cpu.insns);
+    struct memory *mem = dc->mem;
+    init_op_phase();
+
+    uint32_t R[32];
+    memcpy(R, run->cpu.R, sizeof(R));
+    uint32_t PC = run->cpu.pc;
+    long instr_count = run->cpu.insns;
+    long fused_count = stats->fused_insns;
+
+    int *stop = &run->stop;
+    while (!*stop) {
+        SET_PHASE(PHASE_FETCH);
+        if (PC & 3)
+            misaligned_fetch(run, R, PC, instr_count, fused_count);
+        const struct decoded_insn *d = decode_cache_lookup(dc, PC);
+        uint32_t next_pc = PC + 4;
+        int op = d->op;
+        // A superinstruction must not step over the instruction count of a
+        // periodic report, execute only its first half there
+        if (op >= OP_FIRST_FUSED && instr_count + 2 > ticks.next_tick)
+            op = d->op1;
+        SET_PHASE(op_phase[op]);
+        int n = exec_insn(mem, R, stats, d, op, PC, &next_pc, stop);
+        instr_count += n;
+        if (n == 2)
+            fused_count += 2;
+
+        // x0 must remain zero
+        R[0] = 0;
+        PC = next_pc;
+
+        if (check)
+            call_check(check, check_ctx, stop, R, PC, instr_count);
+
+        stats->insns = instr_count;
+        if (instr_count == ticks.next_tick) {
+            stats->fused_insns = fused_count;
+            ticks_report(&ticks, stats);
+        }
+    }
+
+    stats->insns = instr_count;
+    stats->fused_insns = fused_count;
+    memcpy(run->cpu.R, R, sizeof(R));
+    run->cpu.pc = PC;
+    run->cpu.insns = instr_count;
+}
+
+// Block engine ----------------------------------------------------------------
+//
+// Executes whole basic blocks (see block.h) with sp and ra in local
+// variables, so the compiler can keep them in host registers for the length
+// of a block. They are written back to R[] at block exits and around entries
+// marked BLOCK_SYNC. The check hook and periodic reports run between blocks;
+// a block that would step over a report is executed one instruction at a
+// time from the decode cache instead.
+//
+// Targets of backward branches are counted, and hot ones get a trace that
+// is run in place of the block while it keeps staying on its path.
+
+// can op close a loop when it jumps backwards
+static inline int is_loop_edge(int op){
+    return (op >= OP_BEQ && op <= OP_JAL) || (op >= OP_ADDI_BRANCH && op <= OP_ALU_BRANCH);
+}
+
+static void run_blocks(struct sim_session *run){
+    struct block_cache *bc = run->bc;
+    struct Stat *stats = run->stats;
+    sim_check_fn check = run->opts ? run->opts->check : NULL;
+    void *check_ctx = run->opts ? run->opts->check_ctx : NULL;
+    struct ticks ticks;
+    ticks_init(&ticks, run->opts, run->cpu.insns);
+    struct memory *mem = bc->dc->mem;
+    init_op_phase();
+
+    uint32_t R[32];
+    memcpy(R, run->cpu.R, sizeof(R));
+    uint32_t PC = run->cpu.pc;
+    long instr_count = run->cpu.insns;
+    long fused_count = stats->fused_insns;
+    int backward = 0;   // the last block ended with a backward branch
+
+    int *stop = &run->stop;
+    while (!*stop) {
+        SET_PHASE(PHASE_FETCH);
+        if (PC & 3)
+            misaligned_fetch(run, R, PC, instr_count, fused_count);
+        struct block *b = block_lookup(bc, PC);
+        if (backward && !b->trace && ++b->heat >= TRACE_HOT) {
+            if (!trace_form(bc, b))
+                b->heat = -16 * TRACE_HOT;  // try again much later
+        }
+        if (instr_count + b->ninsns > ticks.next_tick) {
+            // step up to the report one instruction at a time
+            const struct decoded_insn *d = decode_cache_lookup(bc->dc, PC);
+            uint32_t next_pc = PC + 4;
+            int op = d->op;
+            if (is_fused(op) && instr_count + 2 > ticks.next_tick)
+                op = d->op1;
+            int n = exec_insn(mem, R, stats, d, op, PC, &next_pc, stop);
+            instr_count += n;
+            if (n == 2)
+                fused_count += 2;
+            R[0] = 0;
+            backward = 0;
+            PC = next_pc;
+        } else {
+            struct block *head = b;
+            if (b->trace && instr_count + b->trace->ninsns <= ticks.next_tick)
+                b = b->trace;
+            uint32_t ra = R[1], sp = R[2];
+            uint32_t pc = PC, last_pc = PC;
+            uint32_t next_pc = pc;
+            int n = 1;      // guest instructions of the entry
+            const struct decoded_insn *d = b->insns, *end = d + b->len;
+            for (; d < end; d++) {
+                next_pc = pc + 4;
+                SET_PHASE(op_phase[d->op]);
+                switch (d->op) {
+                    case OP_LW_SP: R[d->rd] = (uint32_t)memory_rd_w(mem, sp + d->imm); break;
+                    case OP_SW_SP:
+                        memory_wr_w(mem, sp + d->imm, (int)R[d->rs2]);
+                        if (b->stale || *stop)
+                            goto block_done;    // leave right after the store
+                        break;
+                    case OP_LW_RA_SP: ra = (uint32_t)memory_rd_w(mem, sp + d->imm); break;
+                    case OP_SW_RA_SP:
+                        memory_wr_w(mem, sp + d->imm, (int)ra);
+                        if (b->stale || *stop)
+                            goto block_done;    // leave right after the store
+                        break;
+                    case OP_ADDI_SP: sp += d->imm; break;
+                    case OP_CALL:
+                        ra = pc + 4;
+                        next_pc = pc + d->imm;
+                        break;
+                    case OP_RET: next_pc = (ra + d->imm) & ~1u; break;
+                    default:
+                        if (d->flags & BLOCK_SYNC) {
+                            R[1] = ra;
+                            R[2] = sp;
+                        }
+                        n = exec_insn(mem, R, stats, d, d->op, pc, &next_pc, stop);
+                        R[0] = 0;
+                        if (d->flags & BLOCK_SYNC) {
+                            ra = R[1];
+                            sp = R[2];
+                        }
+                        if ((d->flags & BLOCK_STORE) && (b->stale || *stop))
+                            goto block_done;    // leave right after the store
+                        if ((d->flags & BLOCK_GUARD) && next_pc != b->exits[d - b->insns + 1].pc)
+                            goto block_done;    // side exit, only traces have guards
+                        break;
+                }
+                last_pc = pc;
+                pc = next_pc;
+            }
+        block_done:
+            if (d == end) {
+                instr_count += b->ninsns;
+                fused_count += b->nfused;
+                if (b != head) {
+                    b->runs++;
+                    stats->trace_runs++;
+                    stats->trace_insns += b->ninsns;
+                }
+            } else if (b->stale || *stop) {
+                // A store rewrote code of the block, so the rest of it is
+                // stale, or hit a watchpoint: leave right after the store
+                // (and look up pc again)
+                int ninsns, nfused;
+                block_prefix(b, d - b->insns, &ninsns, &nfused);
+                instr_count += ninsns + n;
+                fused_count += n == 2 ? nfused + 2 : nfused;
+                last_pc = pc;
+                d++;
+            } else {
+                const struct trace_exit *e = &b->exits[d - b->insns];
+                instr_count += e->ninsns;
+                fused_count += e->nfused;
+                stats->trace_runs++;
+                stats->trace_exits++;
+                stats->trace_insns += e->ninsns;
+                b->runs++;
+                b->side_exits++;
+                last_pc = pc;
+                d++;
+            }
+            backward = next_pc <= last_pc && is_loop_edge(d[-1].op);
+            if (b != head && !b->stale && b->side_exits * 2 > b->runs && b->runs >= TRACE_RETIRE_RUNS)
+                trace_retire(head);
+            R[1] = ra;
+            R[2] = sp;
+            PC = next_pc;
+        }
+
+        if (check)
+            call_check(check, check_ctx, stop, R, PC, instr_count);
+
+        stats->insns = instr_count;
+        if (instr_count == ticks.next_tick) {
+            stats->fused_insns = fused_count;
+            ticks_report(&ticks, stats);
+        }
+    }
+
+    stats->insns = instr_count;
+    stats->fused_insns = fused_count;
+    memcpy(run->cpu.R, R, sizeof(R));
+    run->cpu.pc = PC;
+    run->cpu.insns = instr_count;
+}
@@ -4,6 +4,7 @@
 #include "memory.h"
 #include "read_elf.h"
 #include <stdio.h>
+#include <stdint.h>
 
 // Simuler RISC-V program i givet lager og fra given start adresse
 struct Stat {
@@ -22,11 +23,140 @@ struct Stat {
 
     long gshare_predictions[4];
     long gshare_mispredictions[4];
+
+    // instructions executed as part of a superinstruction (ENGINE_FUSED, ENGINE_BLOCK)
+    long fused_insns;
+
+    // hot-loop traces (ENGINE_BLOCK)
+    long traces;        // traces formed
+    long trace_runs;    // times a trace was entered
+    long trace_exits;   // runs that left the trace through a side exit
+    long trace_insns;   // instructions executed inside traces
+
+    long misaligned;    // misaligned loads, stores and fetches (see memory.h)
+    long code_writes;   // stores that invalidated decoded code
+};
+
+// Architectural state handed to the check hook
+struct cpu_state {
+    uint32_t R[32];
+    uint32_t pc;    // address of the next instruction to execute
+    long insns;     // instructions executed so far
+};
+
+// Called with the architectural state after every instruction (engines that
+// execute whole blocks may call it once per block). Returning non-zero stops
+// the simulation. Used by the conformance test runner to compare engines.
+typedef int (*sim_check_fn)(void *ctx, const struct cpu_state *state);
+
+// Execution engines, ENGINE_SWITCH is the reference interpreter. The others
+// execute predecoded instructions; logging and MISALIGN_TRAP (see memory.h)
+// always use ENGINE_SWITCH.
+enum sim_engine {
+    ENGINE_SWITCH,
+    ENGINE_PREDECODE,   // decode cache, one instruction per dispatch
+    ENGINE_FUSED,       // decode cache with superinstructions
+    ENGINE_BLOCK,       // basic blocks with sp/ra in host registers
+    NUM_ENGINES
+};
+
+extern const char *sim_engine_names[NUM_ENGINES];
+
+struct statstream;
+struct missprofile;
+
+struct watchpoint {
+    uint32_t addr;
+    uint32_t size;
+};
+
+enum break_action {
+    BREAK_DUMP,     // dump the state and stop
+    BREAK_TRACE,    // dump the state and log the rest of the run
+};
+
+struct callgraph;
+struct lineprof;
+struct dintrace;
+struct reuse;
+struct pageheat;
+
+struct sim_options {
+    enum sim_engine engine;
+    sim_check_fn check;     // NULL when not checking
+    void *check_ctx;
+    struct statstream *stream;  // periodic snapshots, NULL when off
+    long stream_interval;       // instructions between snapshots
+    struct missprofile *miss_profile;   // per-interval mispredictions, NULL when off
+    long miss_interval;
+
+    // Breakpoints stop the run before the instruction at their pc, and
+    // watchpoints right after the store to their range, on every engine.
+    // The state is then dumped to stderr. With
+    // BREAK_TRACE and a log file, the log starts there instead of at the
+    // beginning and the rest of the run is logged by ENGINE_SWITCH.
+    const uint32_t *breakpoints;
+    int num_breakpoints;
+    const struct watchpoint *watchpoints;
+    int num_watchpoints;
+    enum break_action on_break;
+
+    // Ranges decoded before the run starts rather than on first execution
+    // (see decode_cache_prefill), none when num_predecode is 0
+    const struct elf_region *predecode;
+    int num_predecode;
+
+    // call-graph profile (see callgraph.h), NULL when off. Runs on
+    // ENGINE_SWITCH.
+    struct callgraph *callgraph;
+    // execution profile (see lineprof.h), NULL when off. Runs on
+    // ENGINE_SWITCH.
+    struct lineprof *lineprof;
+    // address trace (see dintrace.h), NULL when off. Runs on ENGINE_SWITCH.
+    struct dintrace *din_trace;
+    // reuse distance analysis of loads and stores (see reuse.h), NULL when
+    // off. Runs on ENGINE_SWITCH.
+    struct reuse *reuse;
+    // page heat and working set (see pageheat.h), NULL when off. Runs on
+    // ENGINE_SWITCH.
+    struct pageheat *page_heat;
 };
 
 // NOTE: Use of symbols provide for nicer disassembly, but is not required for A4.
 // Feel free to remove this parameter or pass in a NULL pointer and ignore it.
+// opts may be NULL for the defaults (reference engine, no hooks).
+
+struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file, struct symbols* symbols,
+                     const struct sim_options *opts);
+
+// Run under external control, as by the debugger stub (gdbstub.h). simulate()
+// is create, continue and finish. The breakpoints and watchpoints of opts
+// are set at the start; more can be set with sim_session_set_breakpoints
+// and memory_watch.
+struct sim_session;
+
+enum sim_stop {
+    SIM_STOP_EXIT,          // the program ended
+    SIM_STOP_BREAKPOINT,    // before the instruction at a breakpoint
+    SIM_STOP_WATCHPOINT,    // after a store to a watched range
+    SIM_STOP_STEP,          // a single step is done
+    SIM_STOP_TRAP,          // before a misaligned access with MISALIGN_TRAP,
+                            // or a fetch from a misaligned pc
+};
 
-struct Stat simulate(struct memory *mem, int start_addr, FILE *log_file, struct symbols* symbols);
+struct sim_session *sim_session_create(struct memory *mem, int start_addr, FILE *log_file,
+                                       struct symbols *symbols, const struct sim_options *opts);
+// Run on the selected engine, stepping off a breakpoint at the current pc
+enum sim_stop sim_session_continue(struct sim_session *s);
+// Run one instruction on the reference interpreter
+enum sim_stop sim_session_step(struct sim_session *s);
+// Registers and pc, may be changed between runs
+struct cpu_state *sim_session_cpu(struct sim_session *s);
+// Replace the breakpoints, the list is not copied
+void sim_session_set_breakpoints(struct sim_session *s, const uint32_t *pcs, int num);
+// Address of the store that hit a watchpoint
+uint32_t sim_session_watch_addr(struct sim_session *s);
+// Statistics of the whole run, frees the session
+struct Stat sim_session_finish(struct sim_session *s);
 
 #endif
@@ -0,0 +1,143 @@
+#include "statstream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+// One buffer of the double buffered snapshot. seq is odd while the simulator
+// is writing it, so the writer can detect a torn copy and retry.
+struct snapshot {
+    atomic_uint seq;
+    struct Stat stats;
+    double time;
+};
+
+struct statstream {
+    FILE *out;
+    struct snapshot buf[2];
+    atomic_int latest;      // index of the most recently published buffer
+    atomic_int done;
+    sem_t ready;
+    pthread_t writer;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double rate(long miss, long pred)
+{
+    return pred ? miss * 100.0 / pred : 0.0;
+}
+
+static void write_delta(struct statstream *s, const struct snapshot *prev, const struct snapshot *cur)
+{
+    const struct Stat *a = &prev->stats, *b = &cur->stats;
+    long insns = b->insns - a->insns;
+    double secs = cur->time - prev->time;
+    fprintf(s->out, "%ld,%ld,%.6f,%.2f,%.2f,%.2f", b->insns, insns, secs,
+            secs > 0 ? insns / secs / 1e6 : 0.0,
+            rate(b->nt_mispredictions - a->nt_mispredictions, b->nt_predictions - a->nt_predictions),
+            rate(b->btfnt_mispredictions - a->btfnt_mispredictions, b->btfnt_predictions - a->btfnt_predictions));
+    for (int i = 0; i < 4; i++)
+        fprintf(s->out, ",%.2f", rate(b->bimodal_mispredictions[i] - a->bimodal_mispredictions[i],
+                                      b->bimodal_predictions[i] - a->bimodal_predictions[i]));
+    for (int i = 0; i < 4; i++)
+        fprintf(s->out, ",%.2f", rate(b->gshare_mispredictions[i] - a->gshare_mispredictions[i],
+                                      b->gshare_predictions[i] - a->gshare_predictions[i]));
+    fprintf(s->out, "\n");
+}
+
+// Copy the latest published snapshot, retrying if the simulator overwrote it meanwhile
+static void read_latest(struct statstream *s, struct snapshot *out)
+{
+    for (;;) {
+        struct snapshot *src = &s->buf[atomic_load(&s->latest)];
+        unsigned seq = atomic_load_explicit(&src->seq, memory_order_acquire);
+        if (seq & 1)
+            continue;
+        out->stats = src->stats;
+        out->time = src->time;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&src->seq, memory_order_relaxed) == seq)
+            return;
+    }
+}
+
+static void *writer_main(void *arg)
+{
+    struct statstream *s = arg;
+    struct snapshot prev, cur;
+    memset(&prev, 0, sizeof(prev));
+    prev.time = now();
+    for (;;) {
+        sem_wait(&s->ready);
+        int finishing = atomic_load(&s->done);
+        read_latest(s, &cur);
+        if (cur.stats.insns != prev.stats.insns) {
+            write_delta(s, &prev, &cur);
+            fflush(s->out);
+            prev = cur;
+        }
+        if (finishing)
+            break;
+    }
+    return NULL;
+}
+
+struct statstream *statstream_open(const char *path)
+{
+    FILE *out = strcmp(path, "-") ? fopen(path, "w") : stderr;
+    if (!out)
+        return NULL;
+    struct statstream *s = calloc(1, sizeof(struct statstream));
+    s->out = out;
+    fprintf(out, "insns,interval_insns,seconds,mips,nt_miss%%,btfnt_miss%%,"
+                 "bimodal256_miss%%,bimodal1024_miss%%,bimodal4096_miss%%,bimodal16384_miss%%,"
+                 "gshare256_miss%%,gshare1024_miss%%,gshare4096_miss%%,gshare16384_miss%%\n");
+    sem_init(&s->ready, 0, 0);
+    atomic_store(&s->latest, 0);
+    s->buf[0].time = now();
+    if (pthread_create(&s->writer, NULL, writer_main, s)) {
+        if (out != stderr)
+            fclose(out);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void statstream_publish(struct statstream *s, const struct Stat *stats)
+{
+    // write into the buffer the writer is not reading from
+    int idx = !atomic_load_explicit(&s->latest, memory_order_relaxed);
+    struct snapshot *dst = &s->buf[idx];
+    unsigned seq = atomic_load_explicit(&dst->seq, memory_order_relaxed);
+    atomic_store_explicit(&dst->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    dst->stats = *stats;
+    dst->time = now();
+    atomic_store_explicit(&dst->seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&s->latest, idx, memory_order_release);
+    sem_post(&s->ready);
+}
+
+void statstream_close(struct statstream *s, const struct Stat *final)
+{
+    // the writer always looks at the latest snapshot once it sees done
+    statstream_publish(s, final);
+    atomic_store(&s->done, 1);
+    sem_post(&s->ready);
+    pthread_join(s->writer, NULL);
+    if (s->out != stderr)
+        fclose(s->out);
+    else
+        fflush(stderr);
+    sem_destroy(&s->ready);
+    free(s);
+}
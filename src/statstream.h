@@ -0,0 +1,22 @@
+#ifndef __STATSTREAM_H__
+#define __STATSTREAM_H__
+
+#include "simulate.h"
+
+// Periodic statistics snapshots for long runs. The simulator publishes a copy
+// of its counters every N instructions; a background thread turns consecutive
+// snapshots into interval deltas and writes one line per interval. Publishing
+// never blocks: if the writer falls behind, intervals are merged.
+
+struct statstream;
+
+// open the output (a file, a named pipe, or "-" for stderr) and start the writer
+struct statstream *statstream_open(const char *path);
+
+// called from the simulator, copies the counters into the free buffer
+void statstream_publish(struct statstream *s, const struct Stat *stats);
+
+// write the last snapshot, stop the writer and close the output
+void statstream_close(struct statstream *s, const struct Stat *final);
+
+#endif
@@ -0,0 +1,607 @@
+// Conformance test runner for ../riscv_tests.
+//
+// Every test is loaded into a fresh memory and first run on the reference
+// engine (ENGINE_SWITCH), recording the architectural state after every
+// instruction. Each other engine then runs the same test in its own memory
+// and its state is compared against the reference trace at the same
+// instruction count (after every instruction, or after every block for block
+// based engines); the first divergence stops the run and is reported. Each
+// engine runs twice, decoding lazily and with the test predecoded.
+// Finally the registers are checked against the "# expect:" lines in the test
+// source and the data of the loaded sections is compared across engines.
+// A test with "# watch: addr[:size]" lines is then run once more on every
+// engine with those watchpoints set, continuing after each hit as the
+// debugger stub does, and every engine must stop at the same instructions
+// with the same state as the reference.
+// Misaligned accesses are emulated (MISALIGN_EMULATE), so tests may use them.
+//
+// Tests are taken from relocatable objects made by the assembler (see the
+// 'test' target in the Makefile), or from a prebuilt executable next to the
+// source (name.elf) when no object is found.
+//
+// Usage: run_tests [-o objdir] [-v] test.s...
+
+#include "../memory.h"
+#include "../read_elf.h"
+#include "../simulate.h"
+#include "../elf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define TEXT_BASE 0x10000
+#define MAX_TRACE 100000 // tests are tiny, anything longer is a runaway
+#define MAX_SECTIONS 16
+#define MAX_EXPECT 32
+#define MAX_WATCH 8
+#define MAX_STOPS 64
+
+struct region
+{
+  uint32_t start, end;
+};
+
+struct loaded
+{
+  uint32_t entry;
+  struct region regions[MAX_SECTIONS];
+  int num_regions;
+};
+
+struct expect
+{
+  int reg; // register number, or -1 for the instruction count
+  uint32_t value;
+};
+
+static int verbose;
+
+// Relocatable object loading ------------------------------------------------
+
+static void patch_w(struct memory *mem, uint32_t addr, uint32_t value)
+{
+  memory_wr_w(mem, addr, value);
+}
+
+static uint32_t hi20(uint32_t v)
+{
+  return (v + 0x800) & 0xfffff000;
+}
+
+// Apply one relocation at address p, with value s_a = S + A
+static int apply_reloc(struct memory *mem, int type, uint32_t p, uint32_t s_a,
+                       uint32_t pcrel_lo_value)
+{
+  uint32_t insn = memory_rd_w(mem, p);
+  switch (type)
+  {
+  case R_RISCV_NONE:
+  case R_RISCV_RELAX:
+    return 0;
+  case R_RISCV_32:
+    patch_w(mem, p, s_a);
+    return 0;
+  case R_RISCV_HI20:
+    patch_w(mem, p, (insn & 0xfff) | hi20(s_a));
+    return 0;
+  case R_RISCV_LO12_I:
+    patch_w(mem, p, (insn & 0xfffff) | (s_a << 20));
+    return 0;
+  case R_RISCV_LO12_S:
+    patch_w(mem, p, (insn & 0x1fff07f) | ((s_a & 0x1f) << 7) | ((s_a >> 5) << 25));
+    return 0;
+  case R_RISCV_PCREL_HI20:
+    patch_w(mem, p, (insn & 0xfff) | hi20(s_a - p));
+    return 0;
+  case R_RISCV_PCREL_LO12_I:
+    patch_w(mem, p, (insn & 0xfffff) | (pcrel_lo_value << 20));
+    return 0;
+  case R_RISCV_PCREL_LO12_S:
+    patch_w(mem, p, (insn & 0x1fff07f) | ((pcrel_lo_value & 0x1f) << 7) | ((pcrel_lo_value >> 5) << 25));
+    return 0;
+  case R_RISCV_BRANCH:
+  {
+    uint32_t off = s_a - p;
+    insn &= 0x1fff07f;
+    insn |= ((off >> 12) & 1) << 31 | ((off >> 5) & 0x3f) << 25 | ((off >> 1) & 0xf) << 8 | ((off >> 11) & 1) << 7;
+    patch_w(mem, p, insn);
+    return 0;
+  }
+  case R_RISCV_JAL:
+  {
+    uint32_t off = s_a - p;
+    insn &= 0xfff;
+    insn |= ((off >> 20) & 1) << 31 | ((off >> 1) & 0x3ff) << 21 | ((off >> 11) & 1) << 20 | ((off >> 12) & 0xff) << 12;
+    patch_w(mem, p, insn);
+    return 0;
+  }
+  case R_RISCV_CALL:
+  case R_RISCV_CALL_PLT:
+  {
+    uint32_t off = s_a - p;
+    uint32_t jalr = memory_rd_w(mem, p + 4);
+    patch_w(mem, p, (insn & 0xfff) | hi20(off));
+    patch_w(mem, p + 4, (jalr & 0xfffff) | (off << 20));
+    return 0;
+  }
+  }
+  fprintf(stderr, "unsupported relocation type %d\n", type);
+  return -1;
+}
+
+// Load a relocatable object: allocated sections are laid out from TEXT_BASE
+// in section order, then the relocations against them are applied.
+static int load_object(struct memory *mem, FILE *f, const Elf32_Ehdr *eh, struct loaded *out)
+{
+  Elf32_Shdr *sh = malloc(eh->e_shnum * sizeof(Elf32_Shdr));
+  uint32_t *base = calloc(eh->e_shnum, sizeof(uint32_t));
+  fseek(f, eh->e_shoff, SEEK_SET);
+  if (fread(sh, sizeof(Elf32_Shdr), eh->e_shnum, f) != eh->e_shnum)
+  {
+    free(sh);
+    free(base);
+    return -1;
+  }
+
+  // layout and contents
+  uint32_t addr = TEXT_BASE;
+  out->num_regions = 0;
+  for (int i = 0; i < eh->e_shnum; i++)
+  {
+    if (!(sh[i].sh_flags & SHF_ALLOC) || sh[i].sh_size == 0)
+      continue;
+    uint32_t align = sh[i].sh_addralign < 4 ? 4 : sh[i].sh_addralign;
+    addr = (addr + align - 1) & ~(align - 1);
+    base[i] = addr;
+    if (sh[i].sh_type != SHT_NOBITS)
+    {
+      unsigned char *data = malloc(sh[i].sh_size);
+      fseek(f, sh[i].sh_offset, SEEK_SET);
+      if (fread(data, 1, sh[i].sh_size, f) != sh[i].sh_size)
+      {
+        free(data);
+        free(sh);
+        free(base);
+        return -1;
+      }
+      for (uint32_t j = 0; j < sh[i].sh_size; j++)
+        memory_wr_b(mem, addr + j, data[j]);
+      free(data);
+    }
+    if (out->num_regions < MAX_SECTIONS)
+    {
+      out->regions[out->num_regions].start = addr;
+      out->regions[out->num_regions].end = addr + sh[i].sh_size;
+      out->num_regions++;
+    }
+    addr += sh[i].sh_size;
+  }
+
+  // symbol table
+  Elf32_Sym *syms = NULL;
+  int num_syms = 0;
+  char *strtab = NULL;
+  for (int i = 0; i < eh->e_shnum; i++)
+  {
+    if (sh[i].sh_type != SHT_SYMTAB)
+      continue;
+    num_syms = sh[i].sh_size / sizeof(Elf32_Sym);
+    syms = malloc(sh[i].sh_size);
+    fseek(f, sh[i].sh_offset, SEEK_SET);
+    if (fread(syms, sizeof(Elf32_Sym), num_syms, f) != (size_t)num_syms)
+      num_syms = 0;
+    const Elf32_Shdr *str = &sh[sh[i].sh_link];
+    strtab = malloc(str->sh_size);
+    fseek(f, str->sh_offset, SEEK_SET);
+    if (fread(strtab, 1, str->sh_size, f) != str->sh_size)
+      num_syms = 0;
+  }
+  out->entry = TEXT_BASE;
+  for (int s = 0; s < num_syms; s++)
+    if (!strcmp(strtab + syms[s].st_name, "_start") && syms[s].st_shndx < eh->e_shnum)
+      out->entry = base[syms[s].st_shndx] + syms[s].st_value;
+
+  // relocations
+  int status = 0;
+  for (int i = 0; i < eh->e_shnum && !status; i++)
+  {
+    if (sh[i].sh_type != SHT_RELA || !base[sh[i].sh_info])
+      continue;
+    int n = sh[i].sh_size / sizeof(Elf32_Rela);
+    Elf32_Rela *rela = malloc(sh[i].sh_size);
+    fseek(f, sh[i].sh_offset, SEEK_SET);
+    if (fread(rela, sizeof(Elf32_Rela), n, f) != (size_t)n)
+      status = -1;
+    uint32_t sec_base = base[sh[i].sh_info];
+    for (int r = 0; r < n && !status; r++)
+    {
+      int type = ELF32_R_TYPE(rela[r].r_info);
+      int sym = ELF32_R_SYM(rela[r].r_info);
+      if (sym >= num_syms)
+      {
+        status = -1;
+        break;
+      }
+      uint32_t s_addr = syms[sym].st_shndx < eh->e_shnum ? base[syms[sym].st_shndx] + syms[sym].st_value : 0;
+      uint32_t lo_value = 0;
+      if (type == R_RISCV_PCREL_LO12_I || type == R_RISCV_PCREL_LO12_S)
+      {
+        // the symbol names the auipc, whose PCREL_HI20 gives the real target
+        for (int h = 0; h < n; h++)
+        {
+          if (ELF32_R_TYPE(rela[h].r_info) != R_RISCV_PCREL_HI20 || sec_base + rela[h].r_offset != s_addr)
+            continue;
+          const Elf32_Sym *hs = &syms[ELF32_R_SYM(rela[h].r_info)];
+          uint32_t target = base[hs->st_shndx] + hs->st_value + rela[h].r_addend;
+          lo_value = (target - s_addr) & 0xfff;
+        }
+      }
+      status = apply_reloc(mem, type, sec_base + rela[r].r_offset, s_addr + rela[r].r_addend, lo_value);
+    }
+    free(rela);
+  }
+  free(syms);
+  free(strtab);
+  free(sh);
+  free(base);
+  return status;
+}
+
+static int load_test(struct memory *mem, const char *path, struct loaded *out)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return -1;
+  Elf32_Ehdr eh;
+  int status = -1;
+  if (fread(&eh, sizeof(eh), 1, f) == 1 && !memcmp(eh.e_ident, ELFMAG, SELFMAG))
+  {
+    if (eh.e_type == ET_REL)
+      status = load_object(mem, f, &eh, out);
+    else
+    {
+      struct program_info info;
+      status = read_elf(mem, &info, path, stderr);
+      out->entry = info.start;
+      out->num_regions = 0;
+      for (int i = 0; i < info.num_regions && i < MAX_SECTIONS; i++)
+      {
+        out->regions[i].start = info.regions[i].start;
+        out->regions[i].end = info.regions[i].end;
+        out->num_regions++;
+      }
+    }
+  }
+  fclose(f);
+  return status;
+}
+
+// Expectations --------------------------------------------------------------
+
+// Parse "# expect: x7 = 20" and "# expect: insns = 4" lines from the source
+static int read_expectations(const char *src, struct expect *exp)
+{
+  FILE *f = fopen(src, "r");
+  if (!f)
+    return 0;
+  char line[256];
+  int n = 0;
+  while (n < MAX_EXPECT && fgets(line, sizeof(line), f))
+  {
+    const char *p = strstr(line, "# expect:");
+    if (!p)
+      continue;
+    p += strlen("# expect:");
+    char name[16];
+    long long value;
+    if (sscanf(p, " %15[a-z0-9] = %lli", name, &value) != 2)
+      continue;
+    if (name[0] == 'x')
+      exp[n].reg = atoi(name + 1);
+    else if (!strcmp(name, "insns"))
+      exp[n].reg = -1;
+    else
+      continue;
+    exp[n].value = (uint32_t)value;
+    n++;
+  }
+  fclose(f);
+  return n;
+}
+
+// Parse "# watch: 0x20008" and "# watch: 0x20008:2" lines
+static int read_watches(const char *src, struct watchpoint *w)
+{
+  FILE *f = fopen(src, "r");
+  if (!f)
+    return 0;
+  char line[256];
+  int n = 0;
+  while (n < MAX_WATCH && fgets(line, sizeof(line), f))
+  {
+    const char *p = strstr(line, "# watch:");
+    unsigned long addr, size = 4;
+    if (!p || sscanf(p + strlen("# watch:"), " %li:%li", (long *)&addr, (long *)&size) < 1)
+      continue;
+    w[n].addr = (uint32_t)addr;
+    w[n].size = (uint32_t)size;
+    n++;
+  }
+  fclose(f);
+  return n;
+}
+
+// Lockstep comparison -------------------------------------------------------
+
+struct trace
+{
+  struct cpu_state *states; // states[i] is the state after i+1 instructions
+  long len;
+  int diverged;
+  const char *engine;
+};
+
+static int record_hook(void *ctx, const struct cpu_state *state)
+{
+  struct trace *t = ctx;
+  if (t->len == MAX_TRACE)
+    return 1;
+  t->states[t->len++] = *state;
+  return 0;
+}
+
+static void report_divergence(const struct trace *t, const struct cpu_state *ref, const struct cpu_state *got)
+{
+  printf("    %s diverges after %ld instructions:", t->engine, got->insns);
+  if (ref->pc != got->pc)
+    printf(" pc 0x%08x != 0x%08x", got->pc, ref->pc);
+  for (int r = 0; r < 32; r++)
+    if (ref->R[r] != got->R[r])
+      printf(" x%d 0x%08x != 0x%08x", r, got->R[r], ref->R[r]);
+  printf("\n");
+}
+
+static int compare_hook(void *ctx, const struct cpu_state *state)
+{
+  struct trace *t = ctx;
+  if (state->insns < 1 || state->insns > t->len)
+  {
+    printf("    %s ran past the reference (%ld instructions)\n", t->engine, state->insns);
+    t->diverged = 1;
+    return 1;
+  }
+  const struct cpu_state *ref = &t->states[state->insns - 1];
+  if (ref->pc != state->pc || memcmp(ref->R, state->R, sizeof(ref->R)))
+  {
+    report_divergence(t, ref, state);
+    t->diverged = 1;
+    return 1;
+  }
+  return 0;
+}
+
+// Silence stderr unless verbose, returns what to restore it from
+static int quiet(void)
+{
+  if (verbose)
+    return -1;
+  fflush(stderr);
+  int saved = dup(2);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, 2);
+  close(null_fd);
+  return saved;
+}
+
+static void unquiet(int saved)
+{
+  if (saved < 0)
+    return;
+  fflush(stderr);
+  dup2(saved, 2);
+  close(saved);
+}
+
+// Run the simulator with stderr silenced unless verbose
+static struct Stat run_engine(struct memory *mem, uint32_t entry, const struct sim_options *opts)
+{
+  int saved = quiet();
+  struct Stat stats = simulate(mem, entry, NULL, NULL, opts);
+  unquiet(saved);
+  return stats;
+}
+
+// Run the test in a fresh memory with the watchpoints set, continuing after
+// every hit, and record the state at each of them. Returns the number of hits.
+static int run_watched(const char *path, struct loaded *ld, struct sim_options *opts,
+                       struct cpu_state *stops)
+{
+  struct memory *mem = memory_create();
+  memory_set_misalign_policy(mem, MISALIGN_EMULATE);
+  load_test(mem, path, ld);
+  int saved = quiet();
+  struct sim_session *s = sim_session_create(mem, ld->entry, NULL, NULL, opts);
+  int n = 0;
+  while (n < MAX_STOPS && sim_session_continue(s) == SIM_STOP_WATCHPOINT)
+    stops[n++] = *sim_session_cpu(s);
+  sim_session_finish(s);
+  unquiet(saved);
+  memory_delete(mem);
+  return n;
+}
+
+static int run_test(const char *src, const char *objdir)
+{
+  char name[256], path[1024];
+  const char *base = strrchr(src, '/') ? strrchr(src, '/') + 1 : src;
+  snprintf(name, sizeof(name), "%s", base);
+  char *dot = strrchr(name, '.');
+  if (dot)
+    *dot = 0;
+
+  snprintf(path, sizeof(path), "%s/%s.o", objdir, name);
+  if (access(path, R_OK))
+  {
+    // prebuilt executable next to the source
+    snprintf(path, sizeof(path), "%.*s%s.elf", (int)(base - src), src, name);
+    if (access(path, R_OK))
+    {
+      printf("%-10s SKIP (no object or prebuilt elf)\n", name);
+      return 0;
+    }
+  }
+
+  struct loaded ld;
+  struct memory *ref_mem = memory_create();
+  memory_set_misalign_policy(ref_mem, MISALIGN_EMULATE);
+  if (load_test(ref_mem, path, &ld))
+  {
+    printf("%-10s FAIL (could not load %s)\n", name, path);
+    memory_delete(ref_mem);
+    return 1;
+  }
+
+  struct trace t = {malloc(MAX_TRACE * sizeof(struct cpu_state)), 0, 0, sim_engine_names[ENGINE_SWITCH]};
+  struct sim_options opts = {.engine = ENGINE_SWITCH, .check = record_hook, .check_ctx = &t};
+  run_engine(ref_mem, ld.entry, &opts);
+  int failed = 0;
+  if (t.len == 0 || t.len == MAX_TRACE)
+  {
+    printf("%-10s FAIL (reference ran %ld instructions)\n", name, t.len);
+    failed = 1;
+  }
+
+  // every other engine in lockstep with the reference trace, decoding
+  // lazily and with the loaded sections predecoded
+  struct elf_region predecode[MAX_SECTIONS];
+  for (int r = 0; r < ld.num_regions; r++)
+  {
+    predecode[r].start = ld.regions[r].start;
+    predecode[r].end = ld.regions[r].end;
+    predecode[r].flags = REGION_X;
+  }
+  for (int run = 0; run < 2 * NUM_ENGINES && !failed; run++)
+  {
+    int e = run / 2, pre = run % 2;
+    if (e == ENGINE_SWITCH)
+      continue;
+    struct memory *mem = memory_create();
+    memory_set_misalign_policy(mem, MISALIGN_EMULATE);
+    load_test(mem, path, &ld);
+    char engine[64];
+    snprintf(engine, sizeof(engine), "%s%s", sim_engine_names[e], pre ? " (predecoded)" : "");
+    t.engine = engine;
+    t.diverged = 0;
+    struct sim_options eopts = {.engine = e, .check = compare_hook, .check_ctx = &t};
+    if (pre)
+    {
+      eopts.predecode = predecode;
+      eopts.num_predecode = ld.num_regions;
+    }
+    struct Stat stats = run_engine(mem, ld.entry, &eopts);
+    if (!t.diverged && stats.insns != t.len)
+    {
+      printf("    %s stopped after %ld instructions, reference after %ld\n", t.engine, stats.insns, t.len);
+      t.diverged = 1;
+    }
+    for (int r = 0; r < ld.num_regions && !t.diverged; r++)
+      for (uint32_t a = ld.regions[r].start & ~3u; a < ld.regions[r].end; a += 4)
+        if (memory_rd_w(mem, a) != memory_rd_w(ref_mem, a))
+        {
+          printf("    %s: memory at 0x%08x differs\n", t.engine, a);
+          t.diverged = 1;
+          break;
+        }
+    failed |= t.diverged;
+    memory_delete(mem);
+  }
+
+  // every engine stops at the same watchpoint hits as the reference
+  struct watchpoint watches[MAX_WATCH];
+  int num_watches = read_watches(src, watches);
+  if (num_watches && !failed)
+  {
+    struct cpu_state ref_stops[MAX_STOPS], stops[MAX_STOPS];
+    struct sim_options wopts = {.engine = ENGINE_SWITCH, .watchpoints = watches, .num_watchpoints = num_watches};
+    int num_ref = run_watched(path, &ld, &wopts, ref_stops);
+    if (num_ref == 0)
+    {
+      printf("    no watchpoint hit on the reference\n");
+      failed = 1;
+    }
+    for (int run = 0; run < 2 * NUM_ENGINES && !failed; run++)
+    {
+      int e = run / 2, pre = run % 2;
+      if (e == ENGINE_SWITCH)
+        continue;
+      wopts.engine = e;
+      wopts.predecode = pre ? predecode : NULL;
+      wopts.num_predecode = pre ? ld.num_regions : 0;
+      int n = run_watched(path, &ld, &wopts, stops);
+      for (int i = 0; i < n && i < num_ref && !failed; i++)
+      {
+        if (stops[i].insns != ref_stops[i].insns || stops[i].pc != ref_stops[i].pc
+            || memcmp(stops[i].R, ref_stops[i].R, sizeof(stops[i].R)))
+        {
+          printf("    %s%s stops at watchpoint hit %d after %ld instructions at pc 0x%08x,"
+                 " reference after %ld at 0x%08x\n", sim_engine_names[e], pre ? " (predecoded)" : "",
+                 i + 1, stops[i].insns, stops[i].pc, ref_stops[i].insns, ref_stops[i].pc);
+          failed = 1;
+        }
+      }
+      if (n != num_ref && !failed)
+      {
+        printf("    %s%s stops at %d watchpoint hits, reference at %d\n",
+               sim_engine_names[e], pre ? " (predecoded)" : "", n, num_ref);
+        failed = 1;
+      }
+    }
+  }
+
+  // expectations against the final reference state
+  struct expect exp[MAX_EXPECT];
+  int num_exp = read_expectations(src, exp);
+  const struct cpu_state *final = t.len ? &t.states[t.len - 1] : NULL;
+  for (int i = 0; i < num_exp && final; i++)
+  {
+    uint32_t got = exp[i].reg < 0 ? (uint32_t)final->insns : final->R[exp[i].reg];
+    if (got != exp[i].value)
+    {
+      if (exp[i].reg < 0)
+        printf("    expected %u instructions, got %u\n", exp[i].value, got);
+      else
+        printf("    expected x%d = 0x%08x, got 0x%08x\n", exp[i].reg, exp[i].value, got);
+      failed = 1;
+    }
+  }
+  printf("%-10s %s (%ld instructions, %d expectations, %d engines)\n",
+         name, failed ? "FAIL" : "ok", t.len, num_exp, NUM_ENGINES);
+  free(t.states);
+  memory_delete(ref_mem);
+  return failed;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *objdir = "tests/build";
+  int opt;
+  while ((opt = getopt(argc, argv, "o:v")) != -1)
+  {
+    switch (opt)
+    {
+    case 'o': objdir = optarg; break;
+    case 'v': verbose = 1; break;
+    default:
+      printf("Usage: run_tests [-o objdir] [-v] test.s...\n");
+      return -1;
+    }
+  }
+  int failures = 0, total = 0;
+  for (int i = optind; i < argc; i++, total++)
+    failures += run_test(argv[i], objdir);
+  printf("%d of %d tests passed\n", total - failures, total);
+  return failures != 0;
+}
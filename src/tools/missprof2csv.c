@@ -0,0 +1,95 @@
+// Render a misprediction profile written by 'sim --miss-profile' as CSV.
+//
+// Consecutive intervals can be merged to downsample long runs, either by a
+// fixed factor (-f) or to at most a given number of rows (-n). Each row gives
+// the instruction range, the branch count and, per predictor, the miss rate
+// in percent (or the raw misprediction counts with -c).
+//
+// Usage: missprof2csv [-f factor | -n max-rows] [-c] profile.bin
+
+#include "../missprofile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int main(int argc, char *argv[])
+{
+  long factor = 1, max_rows = 0;
+  int counts = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "f:n:c")) != -1)
+  {
+    switch (opt)
+    {
+    case 'f': factor = atol(optarg); break;
+    case 'n': max_rows = atol(optarg); break;
+    case 'c': counts = 1; break;
+    default: optind = argc + 1;
+    }
+  }
+  if (optind != argc - 1 || factor < 1 || max_rows < 0)
+  {
+    printf("Usage: missprof2csv [-f factor | -n max-rows] [-c] profile.bin\n");
+    return -1;
+  }
+
+  FILE *f = fopen(argv[optind], "rb");
+  if (!f)
+  {
+    perror(argv[optind]);
+    return -1;
+  }
+  struct missprofile_header h;
+  if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, MISSPROFILE_MAGIC, sizeof(h.magic)) ||
+      h.num_columns < 1 || h.num_columns > 64)
+  {
+    fprintf(stderr, "%s: not a misprediction profile\n", argv[optind]);
+    return -1;
+  }
+  char (*names)[MISSPROFILE_NAME_LEN] = malloc(h.num_columns * MISSPROFILE_NAME_LEN);
+  uint32_t **cols = malloc(h.num_columns * sizeof(uint32_t *));
+  int ok = fread(names, MISSPROFILE_NAME_LEN, h.num_columns, f) == h.num_columns;
+  for (uint32_t c = 0; c < h.num_columns; c++)
+  {
+    names[c][MISSPROFILE_NAME_LEN - 1] = 0;
+    cols[c] = malloc(h.num_rows * sizeof(uint32_t) + 1);
+    ok = ok && fread(cols[c], sizeof(uint32_t), h.num_rows, f) == h.num_rows;
+  }
+  fclose(f);
+  if (!ok)
+  {
+    fprintf(stderr, "%s: truncated profile\n", argv[optind]);
+    return -1;
+  }
+  if (max_rows > 0 && (long)h.num_rows > max_rows)
+    factor = (h.num_rows + max_rows - 1) / max_rows;
+
+  // column 0 is the branch count, the rest are mispredictions per predictor
+  printf("start_insn,end_insn,%s", names[0]);
+  for (uint32_t c = 1; c < h.num_columns; c++)
+    printf(",%s%s", names[c], counts ? "" : "_miss%");
+  printf("\n");
+  uint64_t *sum = calloc(h.num_columns, sizeof(uint64_t));
+  for (uint64_t row = 0; row < h.num_rows; row += factor)
+  {
+    uint64_t end = row + factor < h.num_rows ? row + factor : h.num_rows;
+    memset(sum, 0, h.num_columns * sizeof(uint64_t));
+    for (uint64_t r = row; r < end; r++)
+      for (uint32_t c = 0; c < h.num_columns; c++)
+        sum[c] += cols[c][r];
+    uint64_t end_insn = end * h.interval < h.total_insns ? end * h.interval : h.total_insns;
+    printf("%llu,%llu,%llu", (unsigned long long)(row * h.interval),
+           (unsigned long long)end_insn, (unsigned long long)sum[0]);
+    for (uint32_t c = 1; c < h.num_columns; c++)
+    {
+      if (counts)
+        printf(",%llu", (unsigned long long)sum[c]);
+      else
+        printf(",%.2f", sum[0] ? sum[c] * 100.0 / sum[0] : 0.0);
+    }
+    printf("\n");
+  }
+  return 0;
+}